@@ -11,14 +11,40 @@
 // includes
 // --------
 
-#include <algorithm> // copy, equal, lexicographical_compare, max, swap
+#include <algorithm> // copy, copy_n, equal, lexicographical_compare, max, rotate, swap
+#include <atomic>    // atomic, memory_order
 #include <cassert>   // assert
-#include <iterator>  // iterator, bidirectional_iterator_tag
-#include <memory>    // allocator
-#include <stdexcept> // out_of_range
-#include <utility>   // !=, <=, >, >=
-
-#define CHUNK_SIZE 10
+#include <cerrno>    // EINTR, errno
+#include <chrono>    // duration
+#include <condition_variable> // condition_variable
+#include <cstddef>   // max_align_t, ptrdiff_t, size_t
+#include <cstdint>   // int8_t, int16_t, int32_t, int64_t, uint64_t
+#include <cstdlib>   // free, posix_memalign
+#include <cstring>   // memcpy
+#include <exception> // current_exception, exception_ptr, rethrow_exception
+#include <initializer_list> // initializer_list
+#include <iterator>  // iterator_traits, make_move_iterator, next, random_access_iterator_tag
+#include <limits>    // numeric_limits
+#include <memory>    // allocator, allocator_traits
+#include <mutex>     // lock_guard, mutex, unique_lock
+#include <new>       // operator new, operator delete
+#include <numeric>   // accumulate
+#include <stdexcept> // out_of_range, runtime_error
+#include <string>    // string
+#include <system_error> // generic_category, system_error
+#include <thread>    // hardware_concurrency, thread
+#include <type_traits> // enable_if, is_integral
+#include <utility>   // !=, <=, >, >=, forward, move, pair
+#include <vector>    // vector
+
+#if defined(__unix__) || defined(__APPLE__)
+#define DEQUE_POSIX 1
+#include <fcntl.h>    // O_RDONLY, open, posix_fadvise
+#include <sys/mman.h> // madvise, mmap, munmap
+#include <sys/stat.h> // fstat
+#include <sys/uio.h>  // iovec, readv, writev
+#include <unistd.h>   // close, pread, pwrite
+#endif
 
 // -----
 // using
@@ -40,7 +66,7 @@ template <typename A, typename BI>
 BI destroy (A& a, BI b, BI e) {
   while (b != e) {
     --e;
-    a.destroy(&*e);
+    std::allocator_traits<A>::destroy(a, &*e);
   }
   return b;}
 
@@ -56,7 +82,7 @@ BI uninitialized_copy (A& a, II b, II e, BI x) {
     // cout << "*b: " << *b << " *e: " << *(--e) << endl;
     while (b != e) {
       // cout << "&*x: " << &*x << " *b: " << *b << endl;
-      a.construct(&*x, *b);
+      std::allocator_traits<A>::construct(a, &*x, *b);
       ++b;
       ++x;
     }
@@ -76,7 +102,7 @@ BI uninitialized_fill (A& a, BI b, BI e, const U& v) {
   BI p = b;
   try {
     while (b != e) {
-      a.construct(&*b, v);
+      std::allocator_traits<A>::construct(a, &*b, v);
       ++b;
     }
   }
@@ -87,34 +113,1499 @@ BI uninitialized_fill (A& a, BI b, BI e, const U& v) {
   return e;
 }
 
+// ----------------
+// deque_chunk_bytes
+// ----------------
+
+/**
+ * Default chunk size policy. A chunk holds the largest power of two number
+ * of elements that fits in Bytes, but never fewer than 16, so that index
+ * math reduces to a shift and a mask.
+ */
+template <typename T, std::size_t Bytes = 4096>
+struct deque_chunk_bytes {
+  private:
+    static constexpr std::size_t log2 (std::size_t n) {
+      return n <= 1 ? 0 : 1 + log2(n / 2);}
+
+    static constexpr std::size_t elements =
+        (Bytes / sizeof(T)) < 16 ? 16 : (Bytes / sizeof(T));
+
+  public:
+    static constexpr std::size_t shift = log2(elements);
+    static constexpr std::size_t value = std::size_t(1) << shift;
+    static constexpr std::size_t mask  = value - 1;};
+
+template <typename T, std::size_t Bytes>
+constexpr std::size_t deque_chunk_bytes<T, Bytes>::shift;
+
+template <typename T, std::size_t Bytes>
+constexpr std::size_t deque_chunk_bytes<T, Bytes>::value;
+
+template <typename T, std::size_t Bytes>
+constexpr std::size_t deque_chunk_bytes<T, Bytes>::mask;
+
+// -------------------
+// deque_chunk_elements
+// -------------------
+
+/**
+ * Chunk size policy with an explicit element count, which must be a power
+ * of two. Mostly useful for tests that need to cross chunk boundaries.
+ */
+template <std::size_t N>
+struct deque_chunk_elements {
+  static_assert(N && !(N & (N - 1)), "chunk size must be a power of two");
+
+  private:
+    static constexpr std::size_t log2 (std::size_t n) {
+      return n <= 1 ? 0 : 1 + log2(n / 2);}
+
+  public:
+    static constexpr std::size_t shift = log2(N);
+    static constexpr std::size_t value = N;
+    static constexpr std::size_t mask  = N - 1;};
+
+template <std::size_t N>
+constexpr std::size_t deque_chunk_elements<N>::shift;
+
+template <std::size_t N>
+constexpr std::size_t deque_chunk_elements<N>::value;
+
+template <std::size_t N>
+constexpr std::size_t deque_chunk_elements<N>::mask;
+
+// ---------------------
+// deque_inline_elements
+// ---------------------
+
+/**
+ * Chunk size policy for small deques: chunks of N elements, N a power of
+ * two, the first of which lives inside the my_deque object along with a
+ * small chunk table. A deque that never holds more than about N elements
+ * never touches the allocator; one that outgrows the inline chunk gets
+ * heap chunks as usual. Moving such a deque moves the elements of the
+ * inline chunk one by one.
+ */
+template <std::size_t N>
+struct deque_inline_elements : deque_chunk_elements<N> {
+  static constexpr bool inline_storage = true;};
+
+template <std::size_t N>
+constexpr bool deque_inline_elements<N>::inline_storage;
+
+/**
+ * Whether chunk policy C asks for inline storage.
+ */
+template <typename C, typename = void>
+struct deque_inline_policy : std::false_type {};
+
+template <typename C>
+struct deque_inline_policy<C, typename std::enable_if<C::inline_storage>::type> : std::true_type {};
+
+// -------------------
+// deque_inline_buffer
+// -------------------
+
+/**
+ * The inline chunk of N elements and chunk table of M entries of a
+ * my_deque whose policy asks for them. take_ hands one out if it's free
+ * (and big enough) and returns NULL otherwise; give_ takes it back if p
+ * is it and says whether it was. The primary template, for every other
+ * policy, is empty and never hands anything out, so my_deque pays
+ * nothing for it.
+ */
+template <typename T, std::size_t N, std::size_t M, bool = false>
+struct deque_inline_buffer {
+  static T*   take_chunk ()                  {return NULL;}
+  static bool give_chunk (const T*)          {return false;}
+  static bool owns_chunk (const T*)          {return false;}
+  static T**  take_table (std::size_t)       {return NULL;}
+  static bool give_table (T* const*)         {return false;}
+  static bool owns_table (T* const*)         {return false;}
+  static bool in_use ()                      {return false;}};
+
+template <typename T, std::size_t N, std::size_t M>
+struct deque_inline_buffer<T, N, M, true> {
+  typename std::aligned_storage<sizeof(T), alignof(T)>::type _chunk[N];
+  T*   _table[M + 1];
+  bool _chunk_used;
+  bool _table_used;
+
+  deque_inline_buffer () :
+    _chunk_used(false),
+    _table_used(false) {}
+
+  deque_inline_buffer (const deque_inline_buffer&) :
+    _chunk_used(false),
+    _table_used(false) {}
+
+  deque_inline_buffer& operator = (const deque_inline_buffer&) {
+    return *this;}
+
+  T* take_chunk () {
+    if (_chunk_used)
+      return NULL;
+    _chunk_used = true;
+    return reinterpret_cast<T*>(_chunk);}
+
+  bool give_chunk (const T* p) {
+    if (!owns_chunk(p))
+      return false;
+    _chunk_used = false;
+    return true;}
+
+  bool owns_chunk (const T* p) const {
+    return p == reinterpret_cast<const T*>(_chunk);}
+
+  T** take_table (std::size_t n) {
+    if (_table_used || (n > M))
+      return NULL;
+    _table_used = true;
+    return _table;}
+
+  bool give_table (T* const* p) {
+    if (!owns_table(p))
+      return false;
+    _table_used = false;
+    return true;}
+
+  bool owns_table (T* const* p) const {
+    return p == _table;}
+
+  bool in_use () const {
+    return _chunk_used || _table_used;}};
+
+// -------------------
+// deque_shared_chunks
+// -------------------
+
+/**
+ * Chunk policy wrapper that makes copies of a my_deque share chunks
+ * copy-on-write: copying the deque copies its chunk table and bumps a
+ * reference count per chunk, and whichever deque next writes to a shared
+ * chunk clones it first. Pushes and pops at either end, and access through
+ * [], at, front and back, clone at most the chunks they touch; anything
+ * that hands out a mutable iterator (begin, end, find, insert, erase,
+ * sort through begin...) clones every shared chunk. Elements must be
+ * trivially copyable. Iterators and references taken before a copy must
+ * not be written through after it.
+ */
+template <typename C>
+struct deque_shared_chunks : C {
+  static constexpr bool shared_storage = true;};
+
+template <typename C>
+constexpr bool deque_shared_chunks<C>::shared_storage;
+
+/**
+ * Whether chunk policy C asks for shared chunks.
+ */
+template <typename C, typename = void>
+struct deque_shared_policy : std::false_type {};
+
+template <typename C>
+struct deque_shared_policy<C, typename std::enable_if<C::shared_storage>::type> : std::true_type {};
+
+// ------------------
+// deque_shared_state
+// ------------------
+
+/**
+ * The chunk reference counts of a my_deque whose policy asks for shared
+ * chunks, and whether it may share any. A chunk's count lives in extra
+ * slots allocated past its N elements. The primary template, for every
+ * other policy, is empty: every chunk is unique, so my_deque pays
+ * nothing for it.
+ */
+template <typename T, std::size_t N, bool = false>
+struct deque_shared_state {
+  static constexpr std::size_t extra = 0;
+
+  static void adopt   (T*)       {}
+  static void retain  (T*)       {}
+  static bool release (T*)       {return true;}
+  static bool unique  (const T*) {return true;}
+  static bool shared  ()         {return false;}
+  static void shared  (bool)     {}};
+
+template <typename T, std::size_t N, bool B>
+constexpr std::size_t deque_shared_state<T, N, B>::extra;
+
+template <typename T, std::size_t N>
+struct deque_shared_state<T, N, true> {
+  typedef std::atomic<long> count_type;
+
+  //! Byte offset of the count from the start of a chunk
+  static constexpr std::size_t offset =
+      (N * sizeof(T) + alignof(count_type) - 1) / alignof(count_type) * alignof(count_type);
+
+  //! Slots past the N elements of a chunk that hold the count
+  static constexpr std::size_t extra = (offset + sizeof(count_type) + sizeof(T) - 1) / sizeof(T) - N;
+
+  //! Set once this deque has shared chunks with a copy, cleared once it
+  //! has cloned them all; a copy sets it on the deque copied from too
+  mutable std::atomic<bool> _shared;
+
+  deque_shared_state () :
+    _shared(false) {}
+
+  deque_shared_state (const deque_shared_state&) :
+    _shared(false) {}
+
+  deque_shared_state& operator = (const deque_shared_state&) {
+    return *this;}
+
+  static count_type& count (const T* p) {
+    return *reinterpret_cast<count_type*>(reinterpret_cast<char*>(const_cast<T*>(p)) + offset);}
+
+  static void adopt (T* p) {
+    ::new (static_cast<void*>(&count(p))) count_type(1);}
+
+  static void retain (T* p) {
+    count(p).fetch_add(1, std::memory_order_relaxed);}
+
+  //! Drop a reference and say whether it was the last one
+  static bool release (T* p) {
+    return count(p).fetch_sub(1, std::memory_order_acq_rel) == 1;}
+
+  static bool unique (const T* p) {
+    return count(p).load(std::memory_order_acquire) == 1;}
+
+  bool shared () const {
+    return _shared.load(std::memory_order_relaxed);}
+
+  void shared (bool s) const {
+    _shared.store(s, std::memory_order_relaxed);}};
+
+template <typename T, std::size_t N>
+constexpr std::size_t deque_shared_state<T, N, true>::offset;
+
+template <typename T, std::size_t N>
+constexpr std::size_t deque_shared_state<T, N, true>::extra;
+
+// --------------
+// deque_prefetch
+// --------------
+
+/**
+ * Ask for the first cache line at p to be fetched ahead of use. Chunk
+ * hops in iteration and the segmented algorithms prefetch the chunk after
+ * the one they're entering, an address the hardware prefetcher can't
+ * guess. p may be NULL.
+ */
+inline void deque_prefetch (const void* p) {
+#ifdef __GNUC__
+  __builtin_prefetch(p);
+#else
+  (void)p;
+#endif
+}
+
+// ----------------
+// deque_huge_pages
+// ----------------
+
+//! Size of a cache line, the least chunk alignment deque_block_pool gives
+constexpr std::size_t deque_cache_line = 64;
+
+//! Size of a page; chunks that are a multiple of it are aligned to it
+constexpr std::size_t deque_page_size = 4096;
+
+//! Size of a transparent huge page
+constexpr std::size_t deque_huge_page_size = 2 * 1024 * 1024;
+
+inline std::atomic<bool>& deque_huge_pages_flag () {
+  static std::atomic<bool> on(false);
+  return on;}
+
+/**
+ * Whether deque_block_pool carves new slabs out of transparent huge pages.
+ */
+inline bool deque_huge_pages () {
+  return deque_huge_pages_flag().load(std::memory_order_relaxed);}
+
+/**
+ * Carve new deque_block_pool slabs out of huge pages from now on, or stop
+ * doing so. A huge page covers 512 4 KiB chunks with one TLB entry, which
+ * pays off for random access into big deques. Only takes effect where
+ * the kernel supports madvise(MADV_HUGEPAGE).
+ */
+inline void deque_huge_pages (bool on) {
+  deque_huge_pages_flag().store(on, std::memory_order_relaxed);}
+
+// -----------------
+// deque_aligned_new
+// -----------------
+
+/**
+ * Allocate bytes bytes aligned to align, a power of two no less than
+ * alignof(void*). Give them back with deque_aligned_delete.
+ * @throw std::bad_alloc
+ */
+inline void* deque_aligned_new (std::size_t bytes, std::size_t align) {
+#ifdef DEQUE_POSIX
+  void* p;
+  if (::posix_memalign(&p, align, bytes) != 0)
+    throw std::bad_alloc();
+  return p;
+#else
+  (void)align;
+  return ::operator new(bytes);
+#endif
+}
+
+inline void deque_aligned_delete (void* p) {
+#ifdef DEQUE_POSIX
+  std::free(p);
+#else
+  ::operator delete(p);
+#endif
+}
+
+// ----------------
+// deque_block_pool
+// ----------------
+
+/**
+ * A process-wide pool of fixed-size blocks, one pool per block size.
+ * Each thread allocates from and frees to its own free list without
+ * locking; only refilling an empty list or spilling an overlong one takes
+ * the shared lock, batch blocks at a time. Blocks are carved out of slab
+ * pages that are given back when the program exits. Every block is
+ * aligned to a cache line, and blocks that are a multiple of a page to a
+ * page; with deque_huge_pages(true) slabs are huge pages.
+ */
+template <std::size_t Bytes>
+class deque_block_pool {
+  private:
+    struct node {
+      node* next;};
+
+    //! The first block of every slab
+    struct slab {
+      slab*       next;
+      std::size_t bytes;};
+
+  public:
+    //! Alignment of each block
+    static constexpr std::size_t block_align =
+        ((Bytes % deque_page_size) == 0) ? deque_page_size : deque_cache_line;
+
+    //! Size of each block, rounded up to keep every block aligned
+    static constexpr std::size_t block_size =
+        ((Bytes < sizeof(slab) ? sizeof(slab) : Bytes) + block_align - 1) /
+        block_align * block_align;
+
+    //! Blocks moved between a thread and the shared list at once
+    static constexpr std::size_t batch = 32;
+
+    //! Blocks carved out of each slab page
+    static constexpr std::size_t slab_blocks =
+        (65536 / block_size) < batch ? batch : (65536 / block_size);
+
+  private:
+    // ------
+    // shared
+    // ------
+
+    struct shared {
+      std::mutex  lock;
+      node*       free;   //! Blocks no thread has cached
+      slab*       slabs;  //! Every slab page, linked through its first block
+      std::size_t count;  //! Number of slab pages
+
+      shared () : free(NULL), slabs(NULL), count(0) {}
+
+      ~shared () {
+        while (slabs) {
+          slab* n = slabs->next;
+          deque_aligned_delete(slabs);
+          slabs = n;}}};
+
+    // -----
+    // local
+    // -----
+
+    struct local {
+      node*       head;   //! This thread's free list
+      std::size_t count;  //! Length of this thread's free list
+
+      local () : head(NULL), count(0) {}
+
+      ~local () {
+        spill(*this, count);}};
+
+    static shared& global () {
+      static shared s;
+      return s;}
+
+    static local& cache () {
+      static thread_local local c;
+      return c;}
+
+    // ------
+    // refill
+    // ------
+
+    /**
+     * Carve a new slab page, a huge page if deque_huge_pages() and it fits
+     * at least batch blocks, onto g's free list.
+     */
+    static void carve (shared& g) {
+      std::size_t bytes = (slab_blocks + 1) * block_size;
+      std::size_t align = block_align;
+      const bool  huge  = deque_huge_pages() && (deque_huge_page_size / block_size > batch);
+      if (huge)
+        bytes = align = deque_huge_page_size;
+      char* p = static_cast<char*>(deque_aligned_new(bytes, align));
+#if defined(DEQUE_POSIX) && defined(MADV_HUGEPAGE)
+      if (huge)
+        ::madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+      slab* header  = reinterpret_cast<slab*>(p);
+      header->next  = g.slabs;
+      header->bytes = bytes;
+      g.slabs = header;
+      ++g.count;
+      for (std::size_t j = bytes / block_size - 1; j != 0; --j) {
+        node* n = reinterpret_cast<node*>(p + j * block_size);
+        n->next = g.free;
+        g.free = n;}}
+
+    /**
+     * Move batch blocks from the shared list to c, carving a new slab page
+     * whenever the shared list runs dry.
+     */
+    static void refill (local& c) {
+      shared& g = global();
+      std::lock_guard<std::mutex> guard(g.lock);
+      for (std::size_t i = 0; i != batch; ++i) {
+        if (!g.free)
+          carve(g);
+        node* n = g.free;
+        g.free = n->next;
+        n->next = c.head;
+        c.head = n;
+        ++c.count;}}
+
+    // -----
+    // spill
+    // -----
+
+    /**
+     * Move k blocks from c back to the shared list.
+     */
+    static void spill (local& c, std::size_t k) {
+      if (!k)
+        return;
+      node* first = c.head;
+      node* last  = first;
+      for (std::size_t i = 1; i != k; ++i)
+        last = last->next;
+      c.head   = last->next;
+      c.count -= k;
+
+      shared& g = global();
+      std::lock_guard<std::mutex> guard(g.lock);
+      last->next = g.free;
+      g.free = first;}
+
+  public:
+    // --------
+    // allocate
+    // --------
+
+    /**
+     * Return a block of block_size bytes.
+     */
+    static void* allocate () {
+      local& c = cache();
+      if (!c.head)
+        refill(c);
+      node* n = c.head;
+      c.head = n->next;
+      --c.count;
+      return n;}
+
+    // ----------
+    // deallocate
+    // ----------
+
+    /**
+     * Take back a block from allocate(), on this or any other thread.
+     */
+    static void deallocate (void* p) {
+      local& c = cache();
+      node* n = static_cast<node*>(p);
+      n->next = c.head;
+      c.head = n;
+      if (++c.count > 2 * batch)
+        spill(c, batch);}
+
+    // ----------
+    // slab_count
+    // ----------
+
+    /**
+     * Number of slab pages carved so far.
+     */
+    static std::size_t slab_count () {
+      shared& g = global();
+      std::lock_guard<std::mutex> guard(g.lock);
+      return g.count;}};
+
+template <std::size_t Bytes>
+constexpr std::size_t deque_block_pool<Bytes>::block_align;
+
+template <std::size_t Bytes>
+constexpr std::size_t deque_block_pool<Bytes>::block_size;
+
+template <std::size_t Bytes>
+constexpr std::size_t deque_block_pool<Bytes>::batch;
+
+template <std::size_t Bytes>
+constexpr std::size_t deque_block_pool<Bytes>::slab_blocks;
+
+// --------------------
+// deque_pool_allocator
+// --------------------
+
+/**
+ * A stateless allocator that serves requests of exactly Bytes bytes, by
+ * default one my_deque<T> chunk, from deque_block_pool<Bytes> and every
+ * other request from operator new. All instances compare equal, so deques
+ * using it swap and move by exchanging their chunk tables.
+ */
+template <typename T, std::size_t Bytes = deque_chunk_bytes<T>::value * sizeof(T)>
+class deque_pool_allocator {
+  public:
+    // --------
+    // typedefs
+    // --------
+
+    typedef T              value_type;
+    typedef T*             pointer;
+    typedef const T*       const_pointer;
+    typedef T&             reference;
+    typedef const T&       const_reference;
+    typedef std::size_t    size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    template <typename U>
+    struct rebind {
+      typedef deque_pool_allocator<U, Bytes> other;};
+
+    typedef deque_block_pool<Bytes> pool_type;
+
+  private:
+    static bool pooled (size_type n) {
+      return (n * sizeof(T) == Bytes) && (alignof(T) <= pool_type::block_align);}
+
+  public:
+    // -----------
+    // operator ==
+    // -----------
+
+    friend bool operator == (const deque_pool_allocator&, const deque_pool_allocator&) {
+      return true;}
+
+    friend bool operator != (const deque_pool_allocator&, const deque_pool_allocator&) {
+      return false;}
+
+    // ------------
+    // constructors
+    // ------------
+
+    deque_pool_allocator () {}
+
+    template <typename U>
+    deque_pool_allocator (const deque_pool_allocator<U, Bytes>&) {}
+
+    // --------
+    // allocate
+    // --------
+
+    T* allocate (size_type n) {
+      if (pooled(n))
+        return static_cast<T*>(pool_type::allocate());
+      return static_cast<T*>(::operator new(n * sizeof(T)));}
+
+    // ----------
+    // deallocate
+    // ----------
+
+    void deallocate (T* p, size_type n) {
+      if (pooled(n))
+        pool_type::deallocate(p);
+      else
+        ::operator delete(p);}};
+
+// -----------------------
+// deque_aligned_allocator
+// -----------------------
+
+/**
+ * A stateless allocator whose blocks are aligned to Align bytes, or to a
+ * page if they're a multiple of one, so that each my_deque chunk starts
+ * on its own cache line or page without going through a pool.
+ */
+template <typename T, std::size_t Align = deque_cache_line>
+class deque_aligned_allocator {
+  static_assert(Align && !(Align & (Align - 1)), "alignment must be a power of two");
+
+  public:
+    typedef T value_type;
+
+    template <typename U>
+    struct rebind {
+      typedef deque_aligned_allocator<U, Align> other;};
+
+  private:
+    static std::size_t align (std::size_t bytes) {
+      std::size_t a = ((bytes % deque_page_size) == 0) ? deque_page_size : Align;
+      if (a < Align)
+        a = Align;
+      if (a < alignof(T))
+        a = alignof(T);
+      if (a < alignof(void*))
+        a = alignof(void*);
+      return a;}
+
+  public:
+    // -----------
+    // operator ==
+    // -----------
+
+    friend bool operator == (const deque_aligned_allocator&, const deque_aligned_allocator&) {
+      return true;}
+
+    friend bool operator != (const deque_aligned_allocator&, const deque_aligned_allocator&) {
+      return false;}
+
+    // ------------
+    // constructors
+    // ------------
+
+    deque_aligned_allocator () {}
+
+    template <typename U>
+    deque_aligned_allocator (const deque_aligned_allocator<U, Align>&) {}
+
+    // --------
+    // allocate
+    // --------
+
+    T* allocate (std::size_t n) {
+      return static_cast<T*>(deque_aligned_new(n * sizeof(T), align(n * sizeof(T))));}
+
+    // ----------
+    // deallocate
+    // ----------
+
+    void deallocate (T* p, std::size_t) {
+      deque_aligned_delete(p);}};
+
+// ---------------------
+// deque_memory_resource
+// ---------------------
+
+/**
+ * An abstract source of memory, shaped like std::pmr::memory_resource, so
+ * that deques with the same element type can draw on different pools at
+ * run time through deque_polymorphic_allocator.
+ */
+class deque_memory_resource {
+  public:
+    virtual ~deque_memory_resource () {}
+
+    void* allocate (std::size_t bytes, std::size_t align = alignof(std::max_align_t)) {
+      return do_allocate(bytes, align);}
+
+    void deallocate (void* p, std::size_t bytes, std::size_t align = alignof(std::max_align_t)) {
+      do_deallocate(p, bytes, align);}
+
+    bool is_equal (const deque_memory_resource& that) const noexcept {
+      return do_is_equal(that);}
+
+  private:
+    virtual void* do_allocate (std::size_t bytes, std::size_t align) = 0;
+    virtual void  do_deallocate (void* p, std::size_t bytes, std::size_t align) = 0;
+
+    virtual bool do_is_equal (const deque_memory_resource& that) const noexcept {
+      return this == &that;}};
+
+// -------------------------
+// deque_new_delete_resource
+// -------------------------
+
+/**
+ * The memory resource that forwards to operator new and delete.
+ */
+inline deque_memory_resource* deque_new_delete_resource () {
+  struct new_delete : deque_memory_resource {
+    void* do_allocate (std::size_t bytes, std::size_t) {
+      return ::operator new(bytes);}
+
+    void do_deallocate (void* p, std::size_t, std::size_t) {
+      ::operator delete(p);}
+
+    bool do_is_equal (const deque_memory_resource& that) const noexcept {
+      return dynamic_cast<const new_delete*>(&that) != NULL;}};
+
+  static new_delete r;
+  return &r;}
+
+// -------------------
+// deque_pool_resource
+// -------------------
+
+/**
+ * A memory resource that serves blocks of Bytes bytes from
+ * deque_block_pool<Bytes> and everything else from upstream.
+ */
+template <std::size_t Bytes>
+class deque_pool_resource : public deque_memory_resource {
+  private:
+    deque_memory_resource* _upstream;
+
+    static bool pooled (std::size_t bytes, std::size_t align) {
+      return (bytes == Bytes) && (align <= deque_block_pool<Bytes>::block_align);}
+
+    void* do_allocate (std::size_t bytes, std::size_t align) {
+      if (pooled(bytes, align))
+        return deque_block_pool<Bytes>::allocate();
+      return _upstream->allocate(bytes, align);}
+
+    void do_deallocate (void* p, std::size_t bytes, std::size_t align) {
+      if (pooled(bytes, align))
+        deque_block_pool<Bytes>::deallocate(p);
+      else
+        _upstream->deallocate(p, bytes, align);}
+
+  public:
+    explicit deque_pool_resource (deque_memory_resource* upstream = deque_new_delete_resource()) :
+      _upstream(upstream) {}};
+
+// ---------------------------
+// deque_polymorphic_allocator
+// ---------------------------
+
+/**
+ * An allocator that forwards to a deque_memory_resource, shaped like
+ * std::pmr::polymorphic_allocator. Two of them compare equal when their
+ * resources do, which is when deques using them can swap in O(1).
+ */
+template <typename T>
+class deque_polymorphic_allocator {
+  template <typename U>
+  friend class deque_polymorphic_allocator;
+
+  public:
+    typedef T value_type;
+
+  private:
+    deque_memory_resource* _r;
+
+  public:
+    // -----------
+    // operator ==
+    // -----------
+
+    template <typename U>
+    friend bool operator == (const deque_polymorphic_allocator& lhs, const deque_polymorphic_allocator<U>& rhs) {
+      return (lhs._r == rhs._r) || lhs._r->is_equal(*rhs._r);}
+
+    template <typename U>
+    friend bool operator != (const deque_polymorphic_allocator& lhs, const deque_polymorphic_allocator<U>& rhs) {
+      return !(lhs == rhs);}
+
+    // ------------
+    // constructors
+    // ------------
+
+    deque_polymorphic_allocator (deque_memory_resource* r = deque_new_delete_resource()) :
+      _r(r) {}
+
+    template <typename U>
+    deque_polymorphic_allocator (const deque_polymorphic_allocator<U>& that) :
+      _r(that._r) {}
+
+    // --------
+    // resource
+    // --------
+
+    deque_memory_resource* resource () const {
+      return _r;}
+
+    // --------
+    // allocate
+    // --------
+
+    T* allocate (std::size_t n) {
+      return static_cast<T*>(_r->allocate(n * sizeof(T), alignof(T)));}
+
+    // ----------
+    // deallocate
+    // ----------
+
+    void deallocate (T* p, std::size_t n) {
+      _r->deallocate(p, n * sizeof(T), alignof(T));}};
+
+// ---------------------------
+// deque_allocation_counters
+// ---------------------------
+
+/**
+ * Running totals kept by deque_counting_allocator. The counters are
+ * relaxed atomics, so one set can be shared by deques on many threads.
+ */
+struct deque_allocation_counters {
+  std::atomic<std::size_t> allocations;    //! Calls to allocate
+  std::atomic<std::size_t> deallocations;  //! Calls to deallocate
+  std::atomic<std::size_t> bytes;          //! Bytes allocated and not yet deallocated
+  std::atomic<std::size_t> peak_bytes;     //! Most bytes ever outstanding at once
+
+  deque_allocation_counters () :
+    allocations(0), deallocations(0), bytes(0), peak_bytes(0) {}
+
+  void allocated (std::size_t n) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    const std::size_t b = bytes.fetch_add(n, std::memory_order_relaxed) + n;
+    std::size_t p = peak_bytes.load(std::memory_order_relaxed);
+    while ((p < b) && !peak_bytes.compare_exchange_weak(p, b, std::memory_order_relaxed)) {}}
+
+  void deallocated (std::size_t n) {
+    deallocations.fetch_add(1, std::memory_order_relaxed);
+    bytes.fetch_sub(n, std::memory_order_relaxed);}
+
+  /**
+   * The counters default-constructed deque_counting_allocators report to.
+   */
+  static deque_allocation_counters& global () {
+    static deque_allocation_counters c;
+    return c;}};
+
+// ------------------------
+// deque_counting_allocator
+// ------------------------
+
+/**
+ * An allocator adapter that forwards to A and counts calls and bytes in a
+ * deque_allocation_counters, the process-wide one unless given another.
+ * Copies and rebinds share their counters, so a my_deque's chunks and
+ * chunk table are counted together. Two adapters compare equal when their
+ * counters and underlying allocators do.
+ */
+template <typename T, typename A = std::allocator<T> >
+class deque_counting_allocator {
+  template <typename U, typename B>
+  friend class deque_counting_allocator;
+
+  public:
+    // --------
+    // typedefs
+    // --------
+
+    typedef T value_type;
+    typedef A inner_allocator_type;
+
+    template <typename U>
+    struct rebind {
+      typedef deque_counting_allocator<U, typename std::allocator_traits<A>::template rebind_alloc<U> > other;};
+
+    typedef typename std::allocator_traits<A>::propagate_on_container_copy_assignment propagate_on_container_copy_assignment;
+    typedef typename std::allocator_traits<A>::propagate_on_container_move_assignment propagate_on_container_move_assignment;
+    typedef typename std::allocator_traits<A>::propagate_on_container_swap            propagate_on_container_swap;
+
+  private:
+    A                          _a;
+    deque_allocation_counters* _c;
+
+  public:
+    // -----------
+    // operator ==
+    // -----------
+
+    template <typename U, typename B>
+    friend bool operator == (const deque_counting_allocator& lhs, const deque_counting_allocator<U, B>& rhs) {
+      return (lhs._c == rhs._c) && (lhs._a == rhs._a);}
+
+    template <typename U, typename B>
+    friend bool operator != (const deque_counting_allocator& lhs, const deque_counting_allocator<U, B>& rhs) {
+      return !(lhs == rhs);}
+
+    // ------------
+    // constructors
+    // ------------
+
+    deque_counting_allocator () :
+      _a(),
+      _c(&deque_allocation_counters::global()) {}
+
+    explicit deque_counting_allocator (deque_allocation_counters& c, const A& a = A()) :
+      _a(a),
+      _c(&c) {}
+
+    template <typename U, typename B>
+    deque_counting_allocator (const deque_counting_allocator<U, B>& that) :
+      _a(that._a),
+      _c(that._c) {}
+
+    // --------
+    // counters
+    // --------
+
+    deque_allocation_counters& counters () const {
+      return *_c;}
+
+    const A& inner_allocator () const {
+      return _a;}
+
+    // --------
+    // allocate
+    // --------
+
+    T* allocate (std::size_t n) {
+      T* const p = std::allocator_traits<A>::allocate(_a, n);
+      _c->allocated(n * sizeof(T));
+      return p;}
+
+    // ----------
+    // deallocate
+    // ----------
+
+    void deallocate (T* p, std::size_t n) {
+      std::allocator_traits<A>::deallocate(_a, p, n);
+      _c->deallocated(n * sizeof(T));}};
+
+// -----------
+// deque_stats
+// -----------
+
+/**
+ * A snapshot of a my_deque's memory, from my_deque::stats(). The first
+ * group is worked out from the chunk table when asked for and is always
+ * available. The counters in the second group cost an increment on the
+ * paths they count, so they are only kept when DEQUE_STATS is defined
+ * before Deque.h is included; otherwise they read 0 and cost nothing.
+ */
+struct deque_stats {
+  std::size_t chunks;          //! Chunks allocated, including spares
+  std::size_t spare_chunks;    //! Chunks kept for reuse (see my_deque::max_spare_chunks)
+  std::size_t table_capacity;  //! Entries in the chunk table
+  std::size_t live_slots;      //! Slots holding elements, that is size()
+  std::size_t dead_front;      //! Empty slots in allocated chunks before the first element
+  std::size_t dead_back;       //! Empty slots in allocated chunks after the last element
+  std::size_t bytes;           //! Bytes in chunks and the chunk table
+
+  std::size_t table_reallocations; //! Times the chunk table moved to a bigger one
+  std::size_t table_recenters;     //! Times the chunk table was recentered in place
+  std::size_t chunk_allocations;   //! Chunks asked of the allocator
+  std::size_t chunk_deallocations; //! Chunks given back to the allocator
+  std::size_t peak_size;           //! Most elements ever held at once
+};
+
+// -------------
+// deque_segment
+// -------------
+
+/**
+ * A contiguous run of a my_deque's elements, one chunk or part of one, as
+ * handed out by my_deque::segments().
+ */
+template <typename P>
+struct deque_segment {
+  P           data; //! First element of the run
+  std::size_t size; //! Number of elements in the run
+
+  P begin () const {
+    return data;}
+
+  P end () const {
+    return data + size;}};
+
+#ifdef DEQUE_STATS
+#define DEQUE_STAT(s) s
+#else
+#define DEQUE_STAT(s)
+#endif
+
+#ifdef DEQUE_POSIX
+// --------------
+// deque_snapshot
+// --------------
+
+/**
+ * The header of a my_deque snapshot file. The elements follow it
+ * back to back, in the byte order and layout of the machine that wrote
+ * them. The header is 64 bytes long, so the elements of a mapped
+ * snapshot are aligned for any T with alignof(T) <= 64.
+ */
+struct deque_snapshot_header {
+  char          magic[8];      //! deque_snapshot_magic
+  std::uint32_t version;       //! deque_snapshot_version
+  std::uint32_t element_size;  //! sizeof(T)
+  std::uint64_t size;          //! Number of elements
+  std::uint64_t reserved[5];};
+
+static_assert(sizeof(deque_snapshot_header) == 64, "deque_snapshot_header must be 64 bytes");
+
+constexpr char          deque_snapshot_magic[8] = {'m', 'y', 'd', 'e', 'q', 'u', 'e', '\0'};
+constexpr std::uint32_t deque_snapshot_version  = 1;
+
+/**
+ * Most buffers handed to one readv or writev call.
+ */
+constexpr int deque_iov_max = 1024;
+
+/**
+ * Make the header of a snapshot of n elements of size bytes each.
+ */
+inline deque_snapshot_header deque_snapshot_make (std::size_t bytes, std::size_t n) {
+  deque_snapshot_header h = deque_snapshot_header();
+  std::memcpy(h.magic, deque_snapshot_magic, sizeof(h.magic));
+  h.version      = deque_snapshot_version;
+  h.element_size = bytes;
+  h.size         = n;
+  return h;}
+
+/**
+ * Throw std::runtime_error unless h is a snapshot of elements of size
+ * bytes each.
+ */
+inline void deque_snapshot_check (const deque_snapshot_header& h, std::size_t bytes) {
+  if (std::memcmp(h.magic, deque_snapshot_magic, sizeof(h.magic)) != 0)
+    throw std::runtime_error("deque snapshot: bad magic");
+  if (h.version != deque_snapshot_version)
+    throw std::runtime_error("deque snapshot: unsupported version");
+  if (h.element_size != bytes)
+    throw std::runtime_error("deque snapshot: element size mismatch");}
+
+/**
+ * Move every byte described by the n buffers at v to (out) or from fd,
+ * with as few readv or writev calls as it takes, retrying after signals
+ * and short transfers. v is used up in the process.
+ * @throw std::system_error on an I/O error, std::runtime_error on a read
+ *        that hits end of file
+ */
+inline void deque_transfer (int fd, iovec* v, int n, bool out) {
+  while (n) {
+    const ssize_t r = out ? ::writev(fd, v, std::min(n, deque_iov_max))
+                          : ::readv (fd, v, std::min(n, deque_iov_max));
+    if (r < 0) {
+      if (errno == EINTR)
+        continue;
+      throw std::system_error(errno, std::generic_category(), out ? "writev" : "readv");}
+    std::size_t k = r;
+    while (n && (k >= v->iov_len)) {
+      k -= v->iov_len;
+      ++v;
+      --n;}
+    if (n && (r == 0) && !out)
+      throw std::runtime_error("deque snapshot: truncated");
+    if (n) {
+      v->iov_base = static_cast<char*>(v->iov_base) + k;
+      v->iov_len -= k;}}}
+
+/**
+ * Move n bytes between p and fd at offset off, out to fd if out, with
+ * pwrite or pread, retrying after signals and short transfers.
+ * @throw std::system_error on an I/O error, std::runtime_error on a read
+ *        that hits end of file
+ */
+inline void deque_transfer_at (int fd, void* p, std::size_t n, off_t off, bool out) {
+  char* b = static_cast<char*>(p);
+  while (n) {
+    const ssize_t r = out ? ::pwrite(fd, b, n, off) : ::pread(fd, b, n, off);
+    if (r < 0) {
+      if (errno == EINTR)
+        continue;
+      throw std::system_error(errno, std::generic_category(), out ? "pwrite" : "pread");}
+    if (r == 0)
+      throw std::runtime_error("deque spill file: truncated");
+    b   += r;
+    off += r;
+    n   -= r;}}
+#endif
+
+// -------------------
+// deque_scalar_kernel
+// -------------------
+
+/**
+ * Scans over a contiguous run of elements: one element at a time. Works
+ * for any T with the operators involved; see deque_simd_kernel for the
+ * vectorized version.
+ */
+template <typename T>
+struct deque_scalar_kernel {
+  static std::size_t count (const T* b, const T* e, T x) {
+    std::size_t n = 0;
+    for (; b != e; ++b)
+      if (*b == x)
+        ++n;
+    return n;}
+
+  static bool equal (const T* b, const T* e, const T* y) {
+    for (; b != e; ++b, ++y)
+      if (!(*b == *y))
+        return false;
+    return true;}
+
+  static const T* find (const T* b, const T* e, T x) {
+    for (; b != e; ++b)
+      if (*b == x)
+        break;
+    return b;}
+
+  /**
+   * [b, e) must not be empty.
+   */
+  static std::pair<T, T> minmax (const T* b, const T* e) {
+    std::pair<T, T> r(*b, *b);
+    for (++b; b != e; ++b) {
+      if (*b < r.first)
+        r.first = *b;
+      if (r.second < *b)
+        r.second = *b;}
+    return r;}
+
+  static T sum (const T* b, const T* e) {
+    T s = T();
+    for (; b != e; ++b)
+      s = s + *b;
+    return s;}};
+
+// ---------
+// deque_isa
+// ---------
+
+/**
+ * Instruction sets the scans can use, in increasing order.
+ */
+enum class deque_isa {scalar, sse2, avx2, avx512};
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DEQUE_SIMD 1
+// Kernels get compiled into each instruction set's entry point
+#define DEQUE_SIMD_INLINE __attribute__((always_inline)) inline
+#else
+#define DEQUE_SIMD_INLINE inline
+#endif
+
+/**
+ * The best instruction set this CPU supports.
+ */
+inline deque_isa deque_detect_isa () {
+#ifdef DEQUE_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+    return deque_isa::avx512;
+  if (__builtin_cpu_supports("avx2"))
+    return deque_isa::avx2;
+  if (__builtin_cpu_supports("sse2"))
+    return deque_isa::sse2;
+#endif
+  return deque_isa::scalar;}
+
+inline std::atomic<deque_isa>& deque_isa_level () {
+  static std::atomic<deque_isa> isa(deque_detect_isa());
+  return isa;}
+
+/**
+ * The instruction set the scans use: the best one available, unless
+ * lowered by deque_simd_isa(deque_isa).
+ */
+inline deque_isa deque_simd_isa () {
+  return deque_isa_level().load(std::memory_order_relaxed);}
+
+/**
+ * Use at most isa for scans from now on, for benchmarking and testing the
+ * narrower kernels. Asking for more than the CPU supports gets the best
+ * it does support.
+ * @return The instruction set now in use
+ */
+inline deque_isa deque_simd_isa (deque_isa isa) {
+  const deque_isa best = deque_detect_isa();
+  deque_isa_level().store(isa < best ? isa : best, std::memory_order_relaxed);
+  return deque_simd_isa();}
+
+// --------------
+// deque_simd ops
+// --------------
+
+// The scans, as ops for deque_scan: run<K> calls kernel K.
+
+struct deque_simd_count {
+  template <typename K, typename T>
+  DEQUE_SIMD_INLINE static std::size_t run (const T* b, const T* e, T x) {
+    return K::count(b, e, x);}};
+
+struct deque_simd_equal {
+  template <typename K, typename T>
+  DEQUE_SIMD_INLINE static bool run (const T* b, const T* e, const T* y) {
+    return K::equal(b, e, y);}};
+
+struct deque_simd_find {
+  template <typename K, typename T>
+  DEQUE_SIMD_INLINE static const T* run (const T* b, const T* e, T x) {
+    return K::find(b, e, x);}};
+
+struct deque_simd_minmax {
+  template <typename K, typename T>
+  DEQUE_SIMD_INLINE static std::pair<T, T> run (const T* b, const T* e) {
+    return K::minmax(b, e);}};
+
+struct deque_simd_sum {
+  template <typename K, typename T>
+  DEQUE_SIMD_INLINE static T run (const T* b, const T* e) {
+    return K::sum(b, e);}};
+
+#ifdef DEQUE_SIMD
+
+// -----------------
+// deque_simd_kernel
+// -----------------
+
+template <std::size_t Size> struct deque_simd_lane;
+template <> struct deque_simd_lane<1> {typedef std::int8_t  type;};
+template <> struct deque_simd_lane<2> {typedef std::int16_t type;};
+template <> struct deque_simd_lane<4> {typedef std::int32_t type;};
+template <> struct deque_simd_lane<8> {typedef std::int64_t type;};
+
+// Integer lanes add as unsigned, so that they wrap instead of overflowing
+template <typename T, bool = std::is_integral<T>::value>
+struct deque_simd_sum_lane {typedef T type;};
+template <typename T>
+struct deque_simd_sum_lane<T, true> {typedef typename std::make_unsigned<T>::type type;};
+
+/**
+ * Scans over a contiguous run of arithmetic elements, Bytes at a time
+ * using GCC vector extensions, with a scalar loop for the tail. Loads are
+ * unaligned. Sums accumulate per lane, so floating point sums round
+ * differently from a left to right loop; min and max assume no NaNs.
+ */
+template <typename T, std::size_t Bytes>
+struct deque_simd_kernel {
+  typedef T    vec  __attribute__((vector_size(Bytes)));
+  typedef typename deque_simd_lane<sizeof(T)>::type lane;
+  //! What comparing two vecs gives: all ones in matching lanes, else zero
+  typedef lane mask __attribute__((vector_size(Bytes)));
+
+  static constexpr std::ptrdiff_t lanes = Bytes / sizeof(T);
+
+  DEQUE_SIMD_INLINE static bool any (const mask& m) {
+    std::uint64_t w[Bytes / 8];
+    std::memcpy(w, &m, Bytes);
+    std::uint64_t r = 0;
+    for (std::size_t i = 0; i != Bytes / 8; ++i)
+      r |= w[i];
+    return r;}
+
+  DEQUE_SIMD_INLINE static std::size_t count (const T* b, const T* e, T x) {
+    vec xs;
+    for (std::ptrdiff_t i = 0; i != lanes; ++i)
+      xs[i] = x;
+    // Matching lanes subtract -1; flush before a narrow lane can overflow
+    const std::ptrdiff_t block = std::min<std::ptrdiff_t>(std::numeric_limits<lane>::max(), 1 << 16);
+    std::size_t n = 0;
+    while (e - b >= lanes) {
+      mask acc = {};
+      for (std::ptrdiff_t k = 0; (k != block) && (e - b >= lanes); ++k, b += lanes) {
+        vec v;
+        std::memcpy(&v, b, Bytes);
+        acc -= (mask)(v == xs);}
+      for (std::ptrdiff_t i = 0; i != lanes; ++i)
+        n += acc[i];}
+    return n + deque_scalar_kernel<T>::count(b, e, x);}
+
+  DEQUE_SIMD_INLINE static bool equal (const T* b, const T* e, const T* y) {
+    for (; e - b >= lanes; b += lanes, y += lanes) {
+      vec u, v;
+      std::memcpy(&u, b, Bytes);
+      std::memcpy(&v, y, Bytes);
+      const mask m = (mask)(u != v);
+      if (any(m))
+        return false;}
+    return deque_scalar_kernel<T>::equal(b, e, y);}
+
+  DEQUE_SIMD_INLINE static const T* find (const T* b, const T* e, T x) {
+    vec xs;
+    for (std::ptrdiff_t i = 0; i != lanes; ++i)
+      xs[i] = x;
+    for (; e - b >= lanes; b += lanes) {
+      vec v;
+      std::memcpy(&v, b, Bytes);
+      const mask m = (mask)(v == xs);
+      if (any(m))
+        break;}
+    return deque_scalar_kernel<T>::find(b, e, x);}
+
+  DEQUE_SIMD_INLINE static std::pair<T, T> minmax (const T* b, const T* e) {
+    std::pair<T, T> r(*b, *b);
+    if (e - b >= lanes) {
+      vec lo, hi;
+      std::memcpy(&lo, b, Bytes);
+      hi = lo;
+      for (b += lanes; e - b >= lanes; b += lanes) {
+        vec v;
+        std::memcpy(&v, b, Bytes);
+        lo = (v < lo) ? v : lo;
+        hi = (hi < v) ? v : hi;}
+      for (std::ptrdiff_t i = 0; i != lanes; ++i) {
+        r.first  = std::min(r.first,  T(lo[i]));
+        r.second = std::max(r.second, T(hi[i]));}}
+    if (b != e) {
+      const std::pair<T, T> t = deque_scalar_kernel<T>::minmax(b, e);
+      r.first  = std::min(r.first,  t.first);
+      r.second = std::max(r.second, t.second);}
+    return r;}
+
+  DEQUE_SIMD_INLINE static T sum (const T* b, const T* e) {
+    typedef typename deque_simd_sum_lane<T>::type sum_lane;
+    typedef sum_lane sum_vec __attribute__((vector_size(Bytes)));
+    // Four accumulators hide the latency of floating point adds
+    sum_vec acc[4] = {};
+    for (; e - b >= 4 * lanes; b += 4 * lanes)
+      for (int k = 0; k != 4; ++k) {
+        sum_vec v;
+        std::memcpy(&v, b + k * lanes, Bytes);
+        acc[k] += v;}
+    for (; e - b >= lanes; b += lanes) {
+      sum_vec v;
+      std::memcpy(&v, b, Bytes);
+      acc[0] += v;}
+    const sum_vec a = (acc[0] + acc[1]) + (acc[2] + acc[3]);
+    sum_lane t = sum_lane();
+    for (std::ptrdiff_t i = 0; i != lanes; ++i)
+      t += a[i];
+    T s = T(t);
+    return s + deque_scalar_kernel<T>::sum(b, e);}};
+
+template <typename T, std::size_t Bytes>
+constexpr std::ptrdiff_t deque_simd_kernel<T, Bytes>::lanes;
+
+// ---------------
+// deque_simd_sse2
+// ---------------
+
+// Each compiles an op for one instruction set
+
+template <typename Op, typename T, typename... Args>
+__attribute__((target("sse2")))
+auto deque_simd_sse2 (const T* b, const T* e, Args... args)
+    -> decltype(Op::template run< deque_scalar_kernel<T> >(b, e, args...)) {
+  return Op::template run< deque_simd_kernel<T, 16> >(b, e, args...);}
+
+template <typename Op, typename T, typename... Args>
+__attribute__((target("avx2")))
+auto deque_simd_avx2 (const T* b, const T* e, Args... args)
+    -> decltype(Op::template run< deque_scalar_kernel<T> >(b, e, args...)) {
+  return Op::template run< deque_simd_kernel<T, 32> >(b, e, args...);}
+
+template <typename Op, typename T, typename... Args>
+__attribute__((target("avx512f,avx512bw")))
+auto deque_simd_avx512 (const T* b, const T* e, Args... args)
+    -> decltype(Op::template run< deque_scalar_kernel<T> >(b, e, args...)) {
+  return Op::template run< deque_simd_kernel<T, 64> >(b, e, args...);}
+
+#endif // DEQUE_SIMD
+
+// ----------
+// deque_scan
+// ----------
+
+/**
+ * Whether the vectorized kernels handle T.
+ */
+template <typename T>
+struct deque_simd_type : std::integral_constant<bool,
+    std::is_arithmetic<T>::value && !std::is_same<T, bool>::value &&
+    !std::is_same<T, long double>::value && (sizeof(T) <= 8)> {};
+
+template <typename Op, typename T, typename... Args>
+auto deque_scan_impl (std::false_type, const T* b, const T* e, Args... args)
+    -> decltype(Op::template run< deque_scalar_kernel<T> >(b, e, args...)) {
+  return Op::template run< deque_scalar_kernel<T> >(b, e, args...);}
+
+#ifdef DEQUE_SIMD
+template <typename Op, typename T, typename... Args>
+auto deque_scan_impl (std::true_type, const T* b, const T* e, Args... args)
+    -> decltype(Op::template run< deque_scalar_kernel<T> >(b, e, args...)) {
+  switch (deque_simd_isa()) {
+    case deque_isa::avx512:
+      return deque_simd_avx512<Op>(b, e, args...);
+    case deque_isa::avx2:
+      return deque_simd_avx2<Op>(b, e, args...);
+    case deque_isa::sse2:
+      return deque_simd_sse2<Op>(b, e, args...);
+    default:
+      return Op::template run< deque_scalar_kernel<T> >(b, e, args...);}}
+#endif
+
+/**
+ * Run scan Op over the contiguous run [b, e), with the widest kernel the
+ * CPU allows for arithmetic T and the scalar kernel otherwise.
+ */
+template <typename Op, typename T, typename... Args>
+auto deque_scan (const T* b, const T* e, Args... args)
+    -> decltype(Op::template run< deque_scalar_kernel<T> >(b, e, args...)) {
+#ifdef DEQUE_SIMD
+  return deque_scan_impl<Op>(deque_simd_type<T>(), b, e, args...);
+#else
+  return deque_scan_impl<Op>(std::false_type(), b, e, args...);
+#endif
+}
+
 // -------
 // my_deque
 // -------
 
-template < typename T, typename A = std::allocator<T> >
-class my_deque {
+template < typename T,
+           typename A = std::allocator<T>,
+           typename C = deque_chunk_bytes<T> >
+class my_deque : private deque_inline_buffer<T, C::value, 8, deque_inline_policy<C>::value>,
+                 private deque_shared_state<T, C::value, deque_shared_policy<C>::value> {
+  static_assert(!deque_shared_policy<C>::value || std::is_trivially_copyable<T>::value,
+                "shared chunks need a trivially copyable T");
+  static_assert(!deque_shared_policy<C>::value || !deque_inline_policy<C>::value,
+                "shared chunks can't be inline");
+
   public:
     // --------
     // typedefs
     // --------
 
     typedef A                                        allocator_type;
-    typedef typename allocator_type::value_type      value_type;
+    typedef std::allocator_traits<A>                 allocator_traits;
+    typedef typename allocator_traits::value_type    value_type;
+
+    typedef typename allocator_traits::size_type       size_type;
+    typedef typename allocator_traits::difference_type difference_type;
+
+    typedef typename allocator_traits::pointer       pointer;
+    typedef typename allocator_traits::const_pointer const_pointer;
 
-    typedef typename allocator_type::size_type       size_type;
-    typedef typename allocator_type::difference_type difference_type;
+    typedef value_type&                              reference;
+    typedef const value_type&                        const_reference;
 
-    typedef typename allocator_type::pointer         pointer;
-    typedef typename allocator_type::const_pointer   const_pointer;
+    typedef C                                        chunk_policy;
 
-    typedef typename allocator_type::reference       reference;
-    typedef typename allocator_type::const_reference const_reference;
+    //! Number of elements per chunk, always a power of two
+    static constexpr size_type chunk_size  = C::value;
+    static constexpr size_type chunk_shift = C::shift;
+    static constexpr size_type chunk_mask  = C::mask;
 
   public:
     // --------
     // iterator
     // --------
 
+    /**
+     * A random access iterator that caches the chunk it points into, so
+     * that ++ and -- are a pointer bump with an occasional chunk hop.
+     */
     class iterator {
 
       friend class my_deque;
@@ -124,7 +1615,7 @@ class my_deque {
         // typedefs
         // --------
 
-        typedef std::bidirectional_iterator_tag    iterator_category;
+        typedef std::random_access_iterator_tag    iterator_category;
         typedef typename my_deque::value_type      value_type;
         typedef typename my_deque::difference_type difference_type;
         typedef typename my_deque::pointer         pointer;
@@ -134,8 +1625,10 @@ class my_deque {
         // ----
         // data
         // ----
-        my_deque* _d;   //! Pointer to the deque over we're iterating 
-        size_type _idx; //! Indexing into chunk table
+        T*  _cur;   //! The element this iterator points to
+        T*  _first; //! Beginning of the current chunk
+        T*  _last;  //! End of the current chunk
+        T** _node;  //! Entry of the current chunk in the chunk table
 
       private:
         // -----
@@ -143,7 +1636,32 @@ class my_deque {
         // -----
 
         bool valid () const {
-          return true;
+          return (!_node && !_cur) ||
+                 (_node && (_first <= _cur) && (_cur <= _last));
+        }
+
+        // --------
+        // set_node
+        // --------
+
+        /**
+         * Point this iterator's chunk at the given chunk table entry.
+         */
+        void set_node (T** n) {
+          _node  = n;
+          _first = *n;
+          _last  = _first + chunk_size;
+        }
+
+        // ------
+        // offset
+        // ------
+
+        /**
+         * Distance from the beginning of the first chunk in the table.
+         */
+        difference_type offset (T** base) const {
+          return (_node - base) * difference_type(chunk_size) + (_cur - _first);
         }
 
       public:
@@ -157,7 +1675,7 @@ class my_deque {
          * @param rhs An iterator reference 
          */
         friend bool operator == (const iterator& lhs, const iterator& rhs) {
-          return (lhs._d == rhs._d) && (lhs._idx == rhs._idx);
+          return lhs._cur == rhs._cur;
         }
 
         /**
@@ -169,6 +1687,31 @@ class my_deque {
           return !(lhs == rhs);
         }
 
+        // ----------
+        // operator <
+        // ----------
+
+        /**
+         * Determine if lhs points before rhs in the same deque.
+         * @param lhs An iterator reference 
+         * @param rhs An iterator reference 
+         */
+        friend bool operator < (const iterator& lhs, const iterator& rhs) {
+          return (lhs._node == rhs._node) ? (lhs._cur < rhs._cur) : (lhs._node < rhs._node);
+        }
+
+        friend bool operator > (const iterator& lhs, const iterator& rhs) {
+          return rhs < lhs;
+        }
+
+        friend bool operator <= (const iterator& lhs, const iterator& rhs) {
+          return !(rhs < lhs);
+        }
+
+        friend bool operator >= (const iterator& lhs, const iterator& rhs) {
+          return !(lhs < rhs);
+        }
+
         // ----------
         // operator +
         // ----------
@@ -183,6 +1726,10 @@ class my_deque {
           return lhs += rhs;
         }
 
+        friend iterator operator + (difference_type lhs, iterator rhs) {
+          return rhs += lhs;
+        }
+
         // ----------
         // operator -
         // ----------
@@ -197,7 +1744,16 @@ class my_deque {
           return lhs -= rhs;
         }
 
-      public:
+        /**
+         * Number of elements from rhs to lhs.
+         * @param lhs An iterator reference 
+         * @param rhs An iterator reference 
+         */
+        friend difference_type operator - (const iterator& lhs, const iterator& rhs) {
+          return lhs.offset(rhs._node) - (rhs._cur - rhs._first);
+        }
+
+      public:
         // -----------
         // constructor
         // -----------
@@ -205,20 +1761,24 @@ class my_deque {
         /**
          * Default constructor
          */
-        iterator () : _d(NULL), _idx(0) {}
+        iterator () : _cur(NULL), _first(NULL), _last(NULL), _node(NULL) {}
 
+      private:
         /**
          * Specified Constructor.
-         * @param d A pointer to the deque over which this iterates 
-         * @param i The virtual index into the deque where this iterator points 
+         * @param c The element this iterator points to
+         * @param n The chunk table entry of the chunk holding c
          */
-        iterator (my_deque* d, size_type i) :
-          _d(d),
-          _idx(i)
+        iterator (T* c, T** n) :
+          _cur(c),
+          _first(*n),
+          _last(*n + chunk_size),
+          _node(n)
         {
           assert(valid());
         }
 
+      public:
         // Default copy, destructor, and copy assignment.
         // iterator (const iterator&);
         // ~iterator ();
@@ -233,7 +1793,7 @@ class my_deque {
          * iterator. 
          */
         reference operator * () const {
-          return (*_d)[_idx];
+          return *_cur;
         }
 
         // -----------
@@ -244,7 +1804,18 @@ class my_deque {
          * Access members of the element to which this iterator points. 
          */
         pointer operator -> () const {
-          return &**this;
+          return _cur;
+        }
+
+        // -----------
+        // operator []
+        // -----------
+
+        /**
+         * Access the element d positions away from this iterator.
+         */
+        reference operator [] (difference_type d) const {
+          return *(*this + d);
         }
 
         // -----------
@@ -256,7 +1827,11 @@ class my_deque {
          * @return A reference to this iterator
          */
         iterator& operator ++ () {
-          _idx++;
+          if (++_cur == _last) {
+            set_node(_node + 1);
+            _cur = _first;
+            deque_prefetch(_node[1]);
+          }
           assert(valid());
           return *this;
         }
@@ -267,8 +1842,7 @@ class my_deque {
          */
         iterator operator ++ (int) {
           iterator x = *this;
-          ++_idx;
-          assert(valid());
+          ++(*this);
           return x;
         }
 
@@ -281,7 +1855,11 @@ class my_deque {
          * @return A reference to this iterator
          */
         iterator& operator -- () {
-          --_idx;
+          if (_cur == _first) {
+            set_node(_node - 1);
+            _cur = _last;
+          }
+          --_cur;
           assert(valid());
           return *this;
         }
@@ -292,8 +1870,7 @@ class my_deque {
          */
         iterator operator -- (int) {
           iterator x = *this;
-          --_idx;
-          assert(valid());
+          --(*this);
           return x;
         }
 
@@ -307,7 +1884,16 @@ class my_deque {
          * @return A reference to this iterator
          */
         iterator& operator += (difference_type d) {
-          _idx += d;
+          const difference_type o = d + (_cur - _first);
+          if ((o >= 0) && (o < difference_type(chunk_size)))
+            _cur += d;
+          else {
+            const difference_type n = (o > 0) ?
+                difference_type(size_type(o) >> chunk_shift) :
+                -difference_type(size_type(-o - 1) >> chunk_shift) - 1;
+            set_node(_node + n);
+            _cur = _first + (o - n * difference_type(chunk_size));
+          }
           assert(valid());
           return *this;
         }
@@ -322,17 +1908,20 @@ class my_deque {
          * @return A reference to this iterator
          */
         iterator& operator -= (difference_type d) {
-          _idx -= d;
-          assert(valid());
-          return *this;
+          return *this += -d;
         }
     };
 
   public:
+    // --------
     // --------------
     // const_iterator
     // --------------
 
+    /**
+     * A random access iterator over a const deque that caches the chunk it points into, so
+     * that ++ and -- are a pointer bump with an occasional chunk hop.
+     */
     class const_iterator {
 
       friend class my_deque;
@@ -342,7 +1931,7 @@ class my_deque {
         // typedefs
         // --------
 
-        typedef std::bidirectional_iterator_tag    iterator_category;
+        typedef std::random_access_iterator_tag    iterator_category;
         typedef typename my_deque::value_type      value_type;
         typedef typename my_deque::difference_type difference_type;
         typedef typename my_deque::const_pointer   pointer;
@@ -352,8 +1941,10 @@ class my_deque {
         // ----
         // data
         // ----
-        my_deque* _d; //! Pointer to the deque over we're iterating 
-        size_type _idx;           //! Indexing into chunk table
+        T*  _cur;   //! The element this const_iterator points to
+        T*  _first; //! Beginning of the current chunk
+        T*  _last;  //! End of the current chunk
+        T** _node;  //! Entry of the current chunk in the chunk table
 
       private:
         // -----
@@ -361,7 +1952,32 @@ class my_deque {
         // -----
 
         bool valid () const {
-          return _d->valid();
+          return (!_node && !_cur) ||
+                 (_node && (_first <= _cur) && (_cur <= _last));
+        }
+
+        // --------
+        // set_node
+        // --------
+
+        /**
+         * Point this const_iterator's chunk at the given chunk table entry.
+         */
+        void set_node (T** n) {
+          _node  = n;
+          _first = *n;
+          _last  = _first + chunk_size;
+        }
+
+        // ------
+        // offset
+        // ------
+
+        /**
+         * Distance from the beginning of the first chunk in the table.
+         */
+        difference_type offset (T** base) const {
+          return (_node - base) * difference_type(chunk_size) + (_cur - _first);
         }
 
       public:
@@ -370,30 +1986,55 @@ class my_deque {
         // -----------
 
         /**
-         * Compare two const_iterators for equality.
-         * @param lhs An const_iterator reference 
-         * @param rhs An const_iterator reference 
+         * Compare two iterators for equality.
+         * @param lhs A const_iterator reference 
+         * @param rhs A const_iterator reference 
          */
         friend bool operator == (const const_iterator& lhs, const const_iterator& rhs) {
-          return (lhs._d == rhs._d) && (lhs._idx == rhs._idx);
+          return lhs._cur == rhs._cur;
         }
 
         /**
-         * Compare two const_iterators for inequality.
-         * @param lhs An const_iterator reference 
-         * @param rhs An const_iterator reference 
+         * Compare two iterators for inequality.
+         * @param lhs A const_iterator reference 
+         * @param rhs A const_iterator reference 
          */
         friend bool operator != (const const_iterator& lhs, const const_iterator& rhs) {
           return !(lhs == rhs);
         }
 
+        // ----------
+        // operator <
+        // ----------
+
+        /**
+         * Determine if lhs points before rhs in the same deque.
+         * @param lhs A const_iterator reference 
+         * @param rhs A const_iterator reference 
+         */
+        friend bool operator < (const const_iterator& lhs, const const_iterator& rhs) {
+          return (lhs._node == rhs._node) ? (lhs._cur < rhs._cur) : (lhs._node < rhs._node);
+        }
+
+        friend bool operator > (const const_iterator& lhs, const const_iterator& rhs) {
+          return rhs < lhs;
+        }
+
+        friend bool operator <= (const const_iterator& lhs, const const_iterator& rhs) {
+          return !(rhs < lhs);
+        }
+
+        friend bool operator >= (const const_iterator& lhs, const const_iterator& rhs) {
+          return !(lhs < rhs);
+        }
+
         // ----------
         // operator +
         // ----------
 
         /**
-         * Increment this const_iterator by a given difference.
-         * @param lhs An const_iterator instance
+         * Increment this random access const_iterator by a given difference.
+         * @param lhs A const_iterator instance
          * @param rhs Desired offset from the current position 
          * @return A const_iterator to the element offset from the start point
          */
@@ -401,13 +2042,17 @@ class my_deque {
           return lhs += rhs;
         }
 
+        friend const_iterator operator + (difference_type lhs, const_iterator rhs) {
+          return rhs += lhs;
+        }
+
         // ----------
         // operator -
         // ----------
 
         /**
-         * Decrement this const_iterator by a given difference.
-         * @param lhs An const_iterator instance
+         * Decrement this random access const_iterator by a given difference.
+         * @param lhs A const_iterator instance
          * @param rhs Desired offset from the current position 
          * @return A const_iterator to the element offset from the start point
          */
@@ -415,25 +2060,51 @@ class my_deque {
           return lhs -= rhs;
         }
 
+        /**
+         * Number of elements from rhs to lhs.
+         * @param lhs A const_iterator reference 
+         * @param rhs A const_iterator reference 
+         */
+        friend difference_type operator - (const const_iterator& lhs, const const_iterator& rhs) {
+          return lhs.offset(rhs._node) - (rhs._cur - rhs._first);
+        }
+
       public:
         // -----------
         // constructor
         // -----------
 
         /**
-         * Constructor 
-         * @param: d A pointer to a deque instance
-         * @param: i This iterator's virtual index into the deque
+         * Default constructor
+         */
+        const_iterator () : _cur(NULL), _first(NULL), _last(NULL), _node(NULL) {}
+
+      private:
+        /**
+         * Specified Constructor.
+         * @param c The element this const_iterator points to
+         * @param n The chunk table entry of the chunk holding c
          */
-        const_iterator (my_deque* d, size_type i) : _d(d), _idx(i) {
+        const_iterator (T* c, T** n) :
+          _cur(c),
+          _first(*n),
+          _last(*n + chunk_size),
+          _node(n)
+        {
           assert(valid());
         }
 
+      public:
         /**
          * Conversion Constructor 
          * @param: i An iterator instance 
          */
-        const_iterator (iterator i) : _d(i._d), _idx(i._idx) {
+        const_iterator (const iterator& i) :
+          _cur(i._cur),
+          _first(i._first),
+          _last(i._last),
+          _node(i._node)
+        {
           assert(valid());
         }
 
@@ -451,7 +2122,7 @@ class my_deque {
          * const_iterator. 
          */
         reference operator * () const {
-          return (*_d)[_idx];
+          return *_cur;
         }
 
         // -----------
@@ -459,11 +2130,21 @@ class my_deque {
         // -----------
 
         /**
-         * Access members of the element to which this const_iterator 
-         * points. 
+         * Access members of the element to which this const_iterator points. 
          */
         pointer operator -> () const {
-          return &**this;
+          return _cur;
+        }
+
+        // -----------
+        // operator []
+        // -----------
+
+        /**
+         * Access the element d positions away from this const_iterator.
+         */
+        reference operator [] (difference_type d) const {
+          return *(*this + d);
         }
 
         // -----------
@@ -475,19 +2156,22 @@ class my_deque {
          * @return A reference to this const_iterator
          */
         const_iterator& operator ++ () {
-          ++_idx;
+          if (++_cur == _last) {
+            set_node(_node + 1);
+            _cur = _first;
+            deque_prefetch(_node[1]);
+          }
           assert(valid());
           return *this;
         }
 
         /**
-         * Decrement (Post) where this const_iterator points by one position. 
+         * Increment (Post) where this const_iterator points by one position. 
          * @return A reference to this const_iterator
          */
         const_iterator operator ++ (int) {
           const_iterator x = *this;
           ++(*this);
-          assert(valid());
           return x;
         }
 
@@ -500,7 +2184,11 @@ class my_deque {
          * @return A reference to this const_iterator
          */
         const_iterator& operator -- () {
-          --_idx;
+          if (_cur == _first) {
+            set_node(_node - 1);
+            _cur = _last;
+          }
+          --_cur;
           assert(valid());
           return *this;
         }
@@ -512,7 +2200,6 @@ class my_deque {
         const_iterator operator -- (int) {
           const_iterator x = *this;
           --(*this);
-          assert(valid());
           return x;
         }
 
@@ -526,7 +2213,16 @@ class my_deque {
          * @return A reference to this const_iterator
          */
         const_iterator& operator += (difference_type d) {
-          _idx += d;
+          const difference_type o = d + (_cur - _first);
+          if ((o >= 0) && (o < difference_type(chunk_size)))
+            _cur += d;
+          else {
+            const difference_type n = (o > 0) ?
+                difference_type(size_type(o) >> chunk_shift) :
+                -difference_type(size_type(-o - 1) >> chunk_shift) - 1;
+            set_node(_node + n);
+            _cur = _first + (o - n * difference_type(chunk_size));
+          }
           assert(valid());
           return *this;
         }
@@ -541,9 +2237,7 @@ class my_deque {
          * @return A reference to this const_iterator
          */
         const_iterator& operator -= (difference_type d) {
-          _idx -= d;
-          assert(valid());
-          return *this;
+          return *this += -d;
         }
     };
 
@@ -558,8 +2252,7 @@ class my_deque {
      * @param rhs A deque reference 
      */
     friend bool operator == (const my_deque& lhs, const my_deque& rhs) {      
-      return std::equal(lhs.begin(), lhs.end(), rhs.begin());
-
+      return (lhs.size() == rhs.size()) && lhs.equal_elements(rhs);
     }
 
     // ----------
@@ -575,6 +2268,31 @@ class my_deque {
       return std::lexicographical_compare(lhs.begin(), lhs.end(), rhs.begin(), rhs.end());
     }
 
+  private:
+    // --------------
+    // equal_elements
+    // --------------
+
+    /**
+     * Compare with a deque of the same size a piece at a time, each piece
+     * running to the nearer chunk end, with SIMD kernels for arithmetic
+     * types (see deque_scan).
+     */
+    bool equal_elements (const my_deque& that) const {
+      const_iterator       i = begin();
+      const_iterator       j = that.begin();
+      const const_iterator e = end();
+      while (i != e) {
+        const difference_type n =
+            std::min(std::min(i._last - i._cur, j._last - j._cur), e - i);
+        if (!deque_scan<deque_simd_equal>(i._cur, i._cur + n, j._cur))
+          return false;
+        i += n;
+        j += n;
+      }
+      return true;
+    }
+
   private:
     // ----
     // data
@@ -584,21 +2302,53 @@ class my_deque {
     allocator_type _chunk_a;
 
     //! Allocates chunk table entries (each of which points to a data chunk)
-    typename allocator_type::template rebind<T*>::other _table_a;
+    typename allocator_traits::template rebind_alloc<T*> _table_a;
     
     T**       _table_p;     //! Handle for the chunk table
     size_type _table_size;  //! Number of entries in the chunk table
-  
-    //! "Physical" begining
-    size_type _b_table_idx; 
-    size_type _b_chunk_idx;
 
-    //! Virtual begining and end
+    //! Table entries [_c_first, _c_last) hold allocated chunks, the rest are
+    //! spare slots kept at both ends so either end can grow in place.
+    //! Chunks before _b's or after _e's are spare chunks: emptied by pops
+    //! and waiting to be rotated to whichever end grows next.
+    size_type _c_first;
+    size_type _c_last;
+
+    //! Begining and end. _e always points into an allocated chunk, so
+    //! that ++ on the last element can always load the next chunk.
     iterator _b;            
     iterator _e;
-    iterator _l;   
 
-      
+    //! Most spare chunks kept around before pops give chunks back
+    size_type _max_spare;
+
+    //! The inline chunk and chunk table, if C asks for them
+    typedef deque_inline_buffer<T, C::value, 8, deque_inline_policy<C>::value> inline_buffer;
+
+    //! Chunk reference counts, if C asks for shared chunks
+    typedef deque_shared_state<T, C::value, deque_shared_policy<C>::value> shared_state;
+
+    //! Slots allocated per chunk, counting any for its reference count
+    static constexpr size_type chunk_slots = chunk_size + shared_state::extra;
+
+#ifdef DEQUE_STATS
+    //! The counters reported by stats()
+    struct counters {
+      size_type table_reallocations = 0;
+      size_type table_recenters     = 0;
+      size_type chunk_allocations   = 0;
+      size_type chunk_deallocations = 0;
+      size_type peak_size           = 0;};
+
+    counters _counters;
+#endif
+
+    //! Smallest chunk table ever allocated
+    static constexpr size_type min_table_size = 8;
+
+  public:
+    //! Default for max_spare_chunks()
+    static constexpr size_type default_max_spare = 4;
 
   private:
     // -----
@@ -606,560 +2356,4440 @@ class my_deque {
     // -----
 
     bool valid () const {
-      bool v = (!_b._idx && !_e._idx && !_l._idx) || 
-               ((_b._idx <= _e._idx) && (_e._idx <= _l._idx));
-      // if (!v) {
-      //   cout << "Invalid Deque: " << endl;
-      //   cout << "\t_b._idx: " << _b._idx << endl;
-      //   cout << "\t_e._idx: " << _e._idx << endl;
-      //   cout << "\t_l._idx: " << _l._idx << endl;
-      // }
-      return v;
+      if (!_b._node)
+        return !_e._node;
+      return (_b <= _e) && (_c_first <= _c_last) && (_c_last <= _table_size) &&
+             (_table_p + _c_first <= _b._node) && (_e._node < _table_p + _c_last) &&
+             (_b._cur < _b._last) && (_e._cur < _e._last);
     }
 
-  public:
-    // ------------
-    // constructors
-    // ------------
+    // -------------
+    // reserve_table
+    // -------------
 
     /**
-     * Default Constructor: An Empty Deque
+     * Make sure there are at least front spare table slots before the first
+     * allocated chunk and back spare slots after the last one. A lopsided
+     * table is recentered in place; otherwise the table at least doubles,
+     * so a run of pushes at either end copies the table O(log n) times.
+     * @param front Spare slots needed before _c_first
+     * @param back  Spare slots needed after _c_last
      */
-    explicit my_deque (const allocator_type& a = allocator_type()) 
-      : my_deque(0, value_type(), a)
-    {
-      assert(size() == 0);
-      assert(_table_size == 0);
-      assert(_b_table_idx == 0);
-      assert(_b_chunk_idx == 0);
+    void reserve_table (size_type front, size_type back) {
+      if (front <= _c_first && back <= _table_size - _c_last)
+        return;
+
+      const size_type used   = _c_last - _c_first;
+      const size_type needed = used + front + back;
+
+      if (2 * needed <= _table_size) {
+        // Plenty of room, it's just all at one end: recenter in place
+        const size_type first = (_table_size - needed) / 2 + front;
+        if (first < _c_first)
+          std::copy(_table_p + _c_first, _table_p + _c_last, _table_p + first);
+        else
+          std::copy_backward(_table_p + _c_first, _table_p + _c_last,
+                             _table_p + first + used);
+        std::fill(_table_p, _table_p + first, pointer());
+        std::fill(_table_p + first + used, _table_p + _table_size, pointer());
+        rebase(_table_p + first - _c_first);
+        _c_first     = first;
+        _c_last      = first + used;
+        DEQUE_STAT(++_counters.table_recenters);
+      }
+      else {
+        // Grow geometrically and center the used entries in the new table
+        const size_type new_size =
+            std::max(std::max(2 * _table_size, needed + 2), min_table_size);
+        const size_type first = (new_size - needed) / 2 + front;
+
+        T** new_table = allocate_table(new_size);
+        std::fill(new_table, new_table + new_size, pointer());
+        std::copy(_table_p + _c_first, _table_p + _c_last, new_table + first);
+        rebase(new_table + first - _c_first);
+        if (_table_p)
+          deallocate_table(_table_p, _table_size);
+
+        _table_p     = new_table;
+        _table_size  = new_size;
+        _c_first     = first;
+        _c_last      = first + used;
+        DEQUE_STAT(++_counters.table_reallocations);
+      }
       assert(valid());
     }
 
+    // ------
+    // rebase
+    // ------
+
     /**
-     * Construct a deque of the specified size.
+     * Point _b and _e at a moved copy of the chunk table.
+     * @param base Where table entry 0 of the old table would now be
      */
-    explicit my_deque (size_type s, const_reference v = value_type(), 
-                       const allocator_type& a = allocator_type()) {
-      // Create chunk table
-      _table_size = (s / CHUNK_SIZE);
-      if((s % CHUNK_SIZE) != 0)
-        _table_size += 1;
-      //cout << "_table_size: " << _table_size << endl;
-      _table_p = _table_a.allocate(_table_size);
-      uninitialized_fill(_table_a, _table_p, _table_p + _table_size, pointer());
-
-      // Allocate chunks and map them into the table
-      for (size_type i = 0; i < _table_size; ++ i) {
-        pointer _chunk_p = _chunk_a.allocate(CHUNK_SIZE);
-        uninitialized_fill(_chunk_a, _chunk_p, _chunk_p + CHUNK_SIZE, v);
-        _table_p[i] = _chunk_p;
+    void rebase (T** base) {
+      if (_b._node) {
+        _b._node = base + (_b._node - _table_p);
+        _e._node = base + (_e._node - _table_p);
       }
+    }
 
-      _b_table_idx = 0;
-      _b_chunk_idx = 0;
-
-      _b = iterator(this, 0);
-      _e = iterator(this, s);
-      _l = iterator(this, _table_size * CHUNK_SIZE);
+    // --------------
+    // allocate_chunk
+    // --------------
 
-      assert(valid());
+    /**
+     * Allocate a chunk of raw storage. Slots are only constructed when
+     * they come to hold an element of this deque.
+     */
+    pointer allocate_chunk () {
+      pointer p = inline_buffer::take_chunk();
+      if (!p) {
+        p = _chunk_a.allocate(chunk_slots);
+        shared_state::adopt(p);
+        DEQUE_STAT(++_counters.chunk_allocations);
+      }
+      return p;
     }
 
     /**
-     * Copy Constructor.
-     * @param that The deque instance to copy 
+     * Give a chunk back to the allocator, or just drop this deque's
+     * reference to it if it's shared.
      */
-    my_deque (const my_deque& that) : _chunk_a(that._chunk_a) {
-      _table_size = (that.size() / CHUNK_SIZE);
-      if((that.size() % CHUNK_SIZE) != 0)
-        _table_size += 1;
-      _table_p = _table_a.allocate(_table_size);
-      uninitialized_fill(_table_a, _table_p, _table_p + _table_size, pointer());
-
-      // Allocate chunks and map them into the table
-      for (size_type i = 0; i < _table_size; ++ i) {
-        pointer _chunk_p = _chunk_a.allocate(CHUNK_SIZE);
-        uninitialized_fill(_chunk_a, _chunk_p, _chunk_p + CHUNK_SIZE, value_type());
-        _table_p[i] = _chunk_p;
+    void deallocate_chunk (pointer p) {
+      if (!inline_buffer::give_chunk(p) && shared_state::release(p)) {
+        _chunk_a.deallocate(p, chunk_slots);
+        DEQUE_STAT(++_counters.chunk_deallocations);
       }
+    }
 
-      _b_table_idx = 0;
-      _b_chunk_idx = 0;
-
-      _b = iterator(this, 0);
-      _e = iterator(this, that.size());
-      _l = iterator(this, _table_size * CHUNK_SIZE);
-
-
-      std::copy(that.begin(), that.end(), begin());
-      assert(valid());
+    /**
+     * A spare chunk p about to be reused: p itself unless it's shared, in
+     * which case a fresh one, since a spare's slots hold nothing to keep.
+     */
+    pointer recycle_chunk (pointer p) {
+      if (shared_state::unique(p))
+        return p;
+      deallocate_chunk(p);
+      return allocate_chunk();
     }
 
-    // ----------
-    // destructor
-    // ----------
+    // --------------
+    // allocate_table
+    // --------------
 
     /**
-     * Deque destructor. Frees all allocated memory. 
+     * Allocate a chunk table of n entries, the inline one if it's free and
+     * big enough, plus a NULL entry past the end, so that an iterator
+     * hopping into the last chunk can always prefetch the next one.
      */
-    ~my_deque () {
-      // Destroy and Deallocate every chunk
-      for (size_type i = 0; i < _table_size; ++i) {
-        pointer chunk_p = _table_p[i];
-        destroy(_chunk_a, chunk_p, chunk_p + CHUNK_SIZE);
-        _chunk_a.deallocate(chunk_p, CHUNK_SIZE);
-      }
-
-      // Destroy and Deallocate the chunk table
-      destroy(_table_a, _table_p, _table_p + _table_size);
-      _table_a.deallocate(_table_p, _table_size);
-      
-      _b._idx = _e._idx = _l._idx = 0;
-      _table_size = 0;
-      _table_p = NULL;
+    T** allocate_table (size_type n) {
+      T** p = inline_buffer::take_table(n);
+      if (!p)
+        p = _table_a.allocate(n + 1);
+      p[n] = pointer();
+      return p;
+    }
 
-      assert(valid());
+    void deallocate_table (T** p, size_type n) {
+      if (!inline_buffer::give_table(p))
+        _table_a.deallocate(p, n + 1);
     }
 
-    // ----------
-    // operator =
-    // ----------
+    // ---------
+    // add_chunk
+    // ---------
 
     /**
-     * Copy Assignment. Make this deque identical to the given deque. 
+     * Map a chunk in after the last allocated chunk, rotating a spare
+     * chunk over from the front if there is one.
      */
-    my_deque& operator = (const my_deque& rhs) {
-
-      // CASE I: This is That
-      if (this == &rhs) {
-        return *this;
-      }
-
-      // CASE II: This is same size as rhs
-      if (size() == rhs.size()) {
-        std::copy(rhs.begin(), rhs.end(), begin());
+    void add_chunk_back () {
+      reserve_table(0, 1);
+      if (_b._node && (_table_p + _c_first < _b._node)) {
+        _table_p[_c_last] = recycle_chunk(_table_p[_c_first]);
+        _table_p[_c_first] = pointer();
+        ++_c_first;
       }
+      else
+        _table_p[_c_last] = allocate_chunk();
+      ++_c_last;
+    }
 
-      // CASE III: Everything Else
-      else {
-        resize(rhs.size());  
-        std::copy(rhs.begin(), rhs.end(), begin());
-      } 
-
-      /*
-      // CASE III: Rhs is smaller than this
-      else if (size() > rhs.size()) {
-        resize(rhs.size());
-        std::copy(rhs.begin(), rhs.end(), begin());
-      }
-    
-      // CASE IV: Rhs is bigger than this, but no allocation needed
-      else if (rhs.size() <= capacity()) {
+    /**
+     * Map a chunk in before the first allocated chunk, rotating a spare
+     * chunk over from the back if there is one.
+     */
+    void add_chunk_front () {
+      reserve_table(1, 0);
+      if (_b._node && (_e._node + 1 < _table_p + _c_last)) {
+        --_c_last;
+        _table_p[_c_first - 1] = recycle_chunk(_table_p[_c_last]);
+        _table_p[_c_last] = pointer();
       }
-      */
-
-      assert(valid());
-      return *this;
+      else
+        _table_p[_c_first - 1] = allocate_chunk();
+      --_c_first;
     }
 
     // -----------
-    // operator []
+    // trim_spares
     // -----------
 
     /**
-     * Access the element at the specified deque index. 
-     * @param index A virtual index into this deque
-     * @return An l-val reference to the element
+     * Give spare chunks back to the allocator, from whichever end has
+     * more, until at most n are left.
      */
-    reference operator [] (size_type index) {
-      // cout << "subscript(" << index << ")" << endl;
-      size_type table_offset = index / CHUNK_SIZE;
-      size_type chunk_offset = index % CHUNK_SIZE;
-
-      // cout << "table offset, chunk_offset: " << "(" << table_offset << ", " << chunk_offset << ")" << endl;
-
-      // cout << "_b_table_idx: " << _b_table_idx << endl;
-      size_type table_idx = _b_table_idx + table_offset;
-      size_type chunk_idx = _b_chunk_idx + chunk_offset;
-
-      if (chunk_idx >= CHUNK_SIZE) {
-        chunk_idx %= CHUNK_SIZE;
-        ++table_idx;
+    void trim_spares (size_type n) {
+      if (!_b._node)
+        return;
+      size_type front = _b._node - (_table_p + _c_first);
+      size_type back  = (_table_p + _c_last) - (_e._node + 1);
+      while (front + back > n) {
+        if (front >= back) {
+          deallocate_chunk(_table_p[_c_first]);
+          _table_p[_c_first++] = pointer();
+          --front;
+        }
+        else {
+          deallocate_chunk(_table_p[--_c_last]);
+          _table_p[_c_last] = pointer();
+          --back;
+        }
       }
-
-      // cout << "table index, chunk index: " << "(" << table_idx << ", " << chunk_idx << ")" << endl;
-
-      return _table_p[table_idx][chunk_idx]; 
     }
 
     /**
-     * Get a const reference to the deque element at the given index. 
+     * Map in the very first chunk and point _b and _e at slot i of it.
      */
-    const_reference operator [] (size_type index) const {
-      return const_cast<my_deque*>(this)->operator[](index);
+    void add_first_chunk (size_type i) {
+      assert(!_b._node);
+      if (_c_first == _c_last)
+        add_chunk_back();
+      _b = _e = iterator(_table_p[_c_first] + i, _table_p + _c_first);
     }
 
-    // --
-    // at
-    // --
+    // -----
+    // share
+    // -----
 
     /**
-     * Get a reference to the deque element at the given index. 
-     * @throws out_of_range exception if the index is out of bounds
+     * Take a new reference to each of that's chunks from _b's to _e's,
+     * in a chunk table of our own, and mark both deques as sharing. This
+     * deque must not own any chunks.
      */
-    reference at (size_type index) {
-      if(index >= size())
-        throw std::out_of_range("deque");
-      return (*this)[index];
+    void share (const my_deque& that) {
+      assert(!_table_p);
+      if (!that._b._node)
+        return;
+      const size_type n = that._e._node - that._b._node + 1;
+      _table_size = std::max(n, min_table_size);
+      _table_p    = allocate_table(_table_size);
+      _c_first    = (_table_size - n) / 2;
+      _c_last     = _c_first + n;
+      std::fill(_table_p, _table_p + _table_size, pointer());
+      std::copy(that._b._node, that._e._node + 1, _table_p + _c_first);
+      for (size_type k = _c_first; k != _c_last; ++k)
+        shared_state::retain(_table_p[k]);
+      _b = iterator(_table_p[_c_first] + (that._b._cur - that._b._first), _table_p + _c_first);
+      _e = iterator(_table_p[_c_last - 1] + (that._e._cur - that._e._first), _table_p + _c_last - 1);
+      shared_state::shared(true);
+      that.shared_state::shared(true);
+      note_size();
     }
 
+    // ---
+    // own
+    // ---
+
     /**
-     * Get a const_reference to the deque element at the given index. 
-     * @throws out_of_range exception if the index is out of bounds
+     * Make the chunk at table entry node this deque's alone, cloning
+     * whatever elements of ours it holds if it's shared, and repoint _b
+     * and _e if they point into it.
      */
-    const_reference at (size_type index) const {
-      return const_cast<my_deque*>(this)->at(index);
+    void own (T** node) {
+      const pointer old_p = *node;
+      if (shared_state::unique(old_p))
+        return;
+      const pointer new_p = allocate_chunk();
+      if ((_b._node <= node) && (node <= _e._node)) {
+        const pointer b = (node == _b._node) ? _b._cur : old_p;
+        const pointer e = (node == _e._node) ? _e._cur : old_p + chunk_size;
+        std::memcpy(static_cast<void*>(new_p + (b - old_p)), b, (e - b) * sizeof(value_type));
+      }
+      deallocate_chunk(old_p);
+      *node = new_p;
+      for (iterator* i : {&_b, &_e})
+        if (i->_node == node) {
+          i->_cur   = new_p + (i->_cur - old_p);
+          i->_first = new_p;
+          i->_last  = new_p + chunk_size;
+        }
     }
 
-    // ----
-    // back
-    // ----
-
     /**
-     * Access the last element
+     * Own the chunk holding the element at index.
      */
-    reference back () {
-      assert(!empty());
-      typename my_deque::iterator e = (*this).end();
-      --e;
-      return *e;
+    void own_at (size_type index) {
+      if (shared_state::shared())
+        own(_b._node + (((_b._cur - _b._first) + index) >> chunk_shift));
     }
 
     /**
-     * Return a non-modifiable reference to the last element of this deque. 
+     * Own every chunk from _e's to the last, before writing at the back.
      */
-    const_reference back () const {
-      assert(!empty());
-      return const_cast<my_deque*>(this)->back();
+    void own_back () {
+      if (shared_state::shared() && _b._node)
+        for (T** node = _e._node; node != _table_p + _c_last; ++node)
+          own(node);
     }
 
-    // -----
-    // begin
-    // -----
-
     /**
-     * Return an iterator to the beginning of this deque.
+     * Own every chunk from the first to _b's, before writing at the front.
      */
-    iterator begin () {
-      return _b;
+    void own_front () {
+      if (shared_state::shared() && _b._node)
+        for (T** node = _table_p + _c_first; node != _b._node + 1; ++node)
+          own(node);
     }
 
     /**
-     * Return a const_iterator to the beginning of this deque.
+     * Own every chunk, before handing out mutable iterators or moving
+     * elements around.
      */
-    const_iterator begin () const {
-      return const_iterator(_b);
+    void own_all () {
+      if (!shared_state::shared())
+        return;
+      for (size_type k = _c_first; k != _c_last; ++k)
+        own(_table_p + k);
+      shared_state::shared(false);
     }
 
-    // -----
-    // clear
-    // -----
-
     /**
-     * Remove all elements from this deque. 
+     * Own every chunk and return the iterator to where i pointed, which
+     * may have been into a chunk that was cloned.
      */
-    void clear () {
-      resize(0);
-      assert(valid());
+    iterator own_all (iterator i) {
+      if (!shared_state::shared())
+        return i;
+      const difference_type d = i - _b;
+      own_all();
+      return _b + d;
     }
 
-    // -----
-    // empty
-    // -----
+    // --------
+    // capacity
+    // --------
 
     /**
-     * Determine if this elements has no elements. 
+     * Number of element slots from the beginning of this deque to the end
+     * of the last allocated chunk.
      */
-    bool empty () const {
-      return !size();
+    size_type capacity () const {
+      if (!_b._node)
+        return 0;
+      return (_table_p + _c_last - _b._node) * chunk_size - (_b._cur - _b._first);
     }
 
-    // ---
-    // end
-    // ---
+  public:
+    // ------------
+    // constructors
+    // ------------
 
     /**
-     * Return an iterator to the end of this deque.
+     * Default Constructor: An Empty Deque
      */
-    iterator end () {
-      return _e;
-    }
+    explicit my_deque (const allocator_type& a = allocator_type()) :
+      _chunk_a(a),
+      _table_a(a),
+      _table_p(NULL),
+      _table_size(0),
+      _c_first(0),
+      _c_last(0),
+      _b(),
+      _e(),
+      _max_spare(default_max_spare)
+    {
+      try {
+        add_first_chunk(0);
+      }
+      catch (...) {
+        release();
+        throw;
+      }
+      assert(size() == 0);
+      assert(valid());
+    }
 
     /**
-     * Return an const_iterator to the end of this deque.
+     * Construct a deque of the specified size.
      */
-    const_iterator end () const {
-      return const_iterator(_e);
+    explicit my_deque (size_type s, const_reference v = value_type(), 
+                       const allocator_type& a = allocator_type()) :
+      _chunk_a(a),
+      _table_a(a),
+      _table_p(NULL),
+      _table_size(0),
+      _c_first(0),
+      _c_last(0),
+      _b(),
+      _e(),
+      _max_spare(default_max_spare)
+    {
+      try {
+        add_first_chunk(0);
+        resize(s, v);
+      }
+      catch (...) {
+        release();
+        throw;
+      }
+      assert(valid());
     }
 
-    // -----
-    // erase
-    // -----
-
     /**
-     * Removes the element at the position indicated by the given iterator. 
+     * Construct a deque holding copies of the elements in [b, e). A range
+     * that can be measured up front sizes the chunk table once.
      */
-    iterator erase (iterator i) {
-      while(i != _e - 1) {
-        *i = *(i + 1);  
-        ++i;
+    template <typename II,
+              typename = typename std::enable_if<!std::is_integral<II>::value>::type>
+    my_deque (II b, II e, const allocator_type& a = allocator_type()) :
+      _chunk_a(a),
+      _table_a(a),
+      _table_p(NULL),
+      _table_size(0),
+      _c_first(0),
+      _c_last(0),
+      _b(),
+      _e(),
+      _max_spare(default_max_spare)
+    {
+      try {
+        add_first_chunk(0);
+        assign(b, e);
+      }
+      catch (...) {
+        release();
+        throw;
       }
-      --_e;
       assert(valid());
-      return iterator();
     }
 
-    // -----
-    // front
-    // -----
+    /**
+     * Construct a deque holding copies of the elements of an initializer list.
+     */
+    my_deque (std::initializer_list<value_type> l,
+              const allocator_type& a = allocator_type()) :
+      my_deque(l.begin(), l.end(), a)
+    {}
 
     /**
-     * Returns a reference to the first element in the deque. 
+     * Copy Constructor.
+     * @param that The deque instance to copy 
      */
-    reference front () {
-      assert(!empty());
-      return *begin();
+    my_deque (const my_deque& that) :
+      _chunk_a(allocator_traits::select_on_container_copy_construction(that._chunk_a)),
+      _table_a(_chunk_a),
+      _table_p(NULL),
+      _table_size(0),
+      _c_first(0),
+      _c_last(0),
+      _b(),
+      _e(),
+      _max_spare(that._max_spare)
+    {
+      if (deque_shared_policy<C>::value && (_chunk_a == that._chunk_a)) {
+        share(that);
+        return;
+      }
+      try {
+        add_first_chunk(0);
+        reserve_back(that.size());
+        construct_back_n(that.begin(), that.size());
+      }
+      catch (...) {
+        release();
+        throw;
+      }
+      assert(valid());
     }
 
     /**
-     * Returns a non-modifiable reference to the first element in the deque. 
+     * Move Constructor. Takes over the chunks of that, which is left empty.
+     * Elements in an inline chunk (see deque_inline_elements) are moved
+     * one by one into this deque's.
+     * @param that The deque instance to move from
      */
-    const_reference front () const {
-      return const_cast<my_deque*>(this)->front();
+    my_deque (my_deque&& that)
+        noexcept(!deque_inline_policy<C>::value || std::is_nothrow_move_constructible<T>::value) :
+      _chunk_a(that._chunk_a),
+      _table_a(that._table_a),
+      _table_p(NULL),
+      _table_size(0),
+      _c_first(0),
+      _c_last(0),
+      _b(),
+      _e(),
+      _max_spare(that._max_spare)
+    {
+      steal(that);
+      assert(valid());
     }
 
-    // ------
-    // insert
-    // ------
+    // ----------
+    // destructor
+    // ----------
 
     /**
-     * Insert the a value before the location pointed to by the given iterator
-     * @param i An iterator specifying the insert position.
-     * @param v The element to insert
-     * @return An iterator pointing to the inserted value
+     * Deque destructor. Frees all allocated memory. 
      */
-    iterator insert (iterator i, const_reference v) {
-      resize(size() + 1); 
-      iterator e = end();
-      while(--e != i) {
-        *e = *(e - 1);
-      }
-      *i = v; 
-      assert(valid()); 
-      return i;
-      // return iterator();
+    ~my_deque () {
+      release();
     }
 
-    // ---
-    // pop
-    // ---
+  private:
+    // -------
+    // release
+    // -------
 
     /**
-     * Removes the last element of the deque. 
+     * Destroy every element, then deallocate every chunk and the chunk table.
      */
-    void pop_back () {
-      assert(!empty());
-      resize(size() - 1);
-      assert(valid());
+    void release () {
+      destroy(_chunk_a, _b, _e);
+      for (size_type i = _c_first; i < _c_last; ++i)
+        deallocate_chunk(_table_p[i]);
+      if (_table_p)
+        deallocate_table(_table_p, _table_size);
+
+      _b = _e = iterator();
+      _table_p = NULL;
+      _table_size = _c_first = _c_last = 0;
     }
 
+    // -----
+    // steal
+    // -----
+
     /**
-     * Removes the first element of this deque. 
+     * Take over the chunk table and chunks of that, leaving it empty
+     * without any chunks. This deque must not own any chunks.
      */
-    void pop_front () {
-      ++_b_chunk_idx;
-      if (_b_chunk_idx > CHUNK_SIZE) {
-        _b_chunk_idx = 0;
-        ++_b_table_idx;
+    void steal (my_deque& that) {
+      assert(!_table_p);
+      _table_p    = that._table_p;
+      _table_size = that._table_size;
+      _c_first    = that._c_first;
+      _c_last     = that._c_last;
+      _b          = that._b;
+      _e          = that._e;
+      _max_spare  = that._max_spare;
+      DEQUE_STAT(_counters = that._counters);
+      DEQUE_STAT(that._counters = counters());
+      shared_state::shared(that.shared_state::shared());
+      that.shared_state::shared(false);
+      if (that.inline_buffer::in_use())
+        adopt_inline(that);
+
+      that._b = that._e = iterator();
+      that._table_p = NULL;
+      that._table_size = that._c_first = that._c_last = 0;
+    }
+
+    // ------------
+    // adopt_inline
+    // ------------
+
+    /**
+     * Called by steal, which has just taken over the table and chunks of
+     * that: move what lives in that's inline chunk and table into ours,
+     * which must be free.
+     */
+    void adopt_inline (my_deque& that) {
+      if (that.inline_buffer::give_table(_table_p)) {
+        T** t = inline_buffer::take_table(_table_size);
+        std::copy(_table_p, _table_p + _table_size + 1, t);
+        rebase(t);
+        _table_p = t;
+      }
+      for (size_type k = _c_first; k != _c_last; ++k) {
+        const pointer old_p = _table_p[k];
+        if (!that.inline_buffer::give_chunk(old_p))
+          continue;
+        const pointer new_p = inline_buffer::take_chunk();
+        T** const     node  = _table_p + k;
+        if ((_b._node <= node) && (node <= _e._node)) {
+          const pointer b = (node == _b._node) ? _b._cur : old_p;
+          const pointer e = (node == _e._node) ? _e._cur : old_p + chunk_size;
+          for (pointer q = b; q != e; ++q) {
+            allocator_traits::construct(_chunk_a, new_p + (q - old_p), std::move(*q));
+            allocator_traits::destroy(_chunk_a, q);
+          }
+        }
+        _table_p[k] = new_p;
+        for (iterator* i : {&_b, &_e})
+          if (i->_node == node) {
+            i->_cur   = new_p + (i->_cur - old_p);
+            i->_first = new_p;
+            i->_last  = new_p + chunk_size;
+          }
+        break;
       }
-      --_e;
-      --_l;
-      assert(valid());
     }
 
-    // ----
-    // push
-    // ----
+  public:
+    // ----------
+    // operator =
+    // ----------
 
     /**
-     * Appends the given element value to the end of the deque. 
-     * @param v The element value
-     * @return void
+     * Copy Assignment. Make this deque identical to the given deque. 
      */
-    void push_back (const_reference v) {
-      if(_e == _l) {
-        resize(size() + 1);
-        *(_e - 1) = v;
+    my_deque& operator = (const my_deque& rhs) {
+
+      // CASE I: This is That
+      if (this == &rhs) {
+        return *this;
       }
-      else {
-        *_e = v;
-        _e++;
+
+      // CASE II: Share chunks (see deque_shared_chunks)
+      if (deque_shared_policy<C>::value && (_chunk_a == rhs._chunk_a)) {
+        release();
+        share(rhs);
+        return *this;
       }
-      assert(valid());
+
+      // CASE III: Copy chunk by chunk
+      assign_n(rhs.begin(), rhs.size());
+      return *this;
     }
 
     /**
-     * Appends the given element value to the front of the deque. 
-     * @param v The element value
-     * @return void
+     * Move Assignment. With equal allocators this takes over the chunks of
+     * rhs; otherwise the elements are moved one by one. rhs is left empty.
      */
-    void push_front (const_reference v) {
-      if(_b_table_idx == 0 && _b_chunk_idx == 0) {
-        T** tmp = _table_p;
-        _table_p = _table_a.allocate(size() + 1);
-        _table_size++;
-        uninitialized_fill(_table_a, _table_p, _table_p + _table_size, pointer());
-        std::copy(tmp, tmp + _table_size - 1, _table_p + 1);
-        pointer _chunk_p = _chunk_a.allocate(CHUNK_SIZE);
-        uninitialized_fill(_chunk_a, _chunk_p, _chunk_p + CHUNK_SIZE, value_type());
-        _table_p[0] = _chunk_p;
-        _b_table_idx = 0;
-        _b_chunk_idx = CHUNK_SIZE - 1;
-
-        // Destroy and Deallocate the old table
-        destroy(_table_a, tmp, tmp + _table_size - 1);
-        _table_a.deallocate(tmp, _table_size - 1);
+    my_deque& operator = (my_deque&& rhs) {
+      if (this == &rhs)
+        return *this;
+
+      if (_chunk_a == rhs._chunk_a) {
+        release();
+        steal(rhs);
       }
       else {
-        if(--_b_chunk_idx < 0) {
-          --_b_table_idx;
-          _b_chunk_idx = CHUNK_SIZE - 1;
-        } 
+        const size_type n = std::min(size(), rhs.size());
+        std::move(rhs.begin(), rhs.begin() + n, begin());
+        truncate(n);
+        reserve_back(rhs.size());
+        for (iterator i = rhs.begin() + n; i != rhs.end(); ++i)
+          construct_back(std::move(*i));
+        rhs.clear();
       }
-      ++_e;
-      ++_l;
-      *_b = v; 
       assert(valid());
+      return *this;
     }
 
-    // ------
-    // resize
-    // ------
+    /**
+     * Replace the contents of this deque with the elements of an
+     * initializer list.
+     */
+    my_deque& operator = (std::initializer_list<value_type> l) {
+      assign(l);
+      return *this;
+    }
+
+    // -----------
+    // operator []
+    // -----------
 
     /**
-     * Resizes the deque to contain s elements. If the current size is 
-     * greater than s, the container is reduced to its first count 
-     * elements as if by repeatedly calling pop_back(). 
-     * @param s The desired new size of this container.
-     * @param v The value to assign elements if expanding size.
-     * @return void
+     * Access the element at the specified deque index. 
+     * @param index A virtual index into this deque
+     * @return An l-val reference to the element
      */
-    void resize (size_type s, const_reference v = value_type()) {
-      // cout << "Entering resize()" << endl;
-      // cout << "Requested size : " << s << " current size: " << size() << endl;
+    reference operator [] (size_type index) {
+      own_at(index);
+      return const_cast<reference>(static_cast<const my_deque&>(*this)[index]);
+    }
 
-      // CASE I: Requested size is exactly existing size
-      if (s == size()) {
-        return;
-      }
+    /**
+     * Get a const reference to the deque element at the given index. 
+     */
+    const_reference operator [] (size_type index) const {
+      // cout << "subscript(" << index << ")" << endl;
+      // Offset from the start of the first chunk; a power of two chunk size
+      // turns the divide and modulo into a shift and a mask.
+      size_type offset = (_b._cur - _b._first) + index;
+      return _b._node[offset >> chunk_shift][offset & chunk_mask];
+    }
 
-      size_type new_table_size = (s / CHUNK_SIZE);
-      if((s % CHUNK_SIZE) != 0 || (size() == 0))
-        new_table_size++;
+    // --
+    // at
+    // --
 
-      // CASE II: Requested size is smaller than existing size
-      if (s < size()) {
-        _e = _b + s; 
-        // TODO: Is it ok we don't destroy anything? I think so.
-      }
+    /**
+     * Get a reference to the deque element at the given index. 
+     * @throws out_of_range exception if the index is out of bounds
+     */
+    reference at (size_type index) {
+      if(index >= size())
+        throw std::out_of_range("deque");
+      return (*this)[index];
+    }
 
-      // CASE III: Requested size is greater than existing size but smaller than capacity
-      else if (s < _l._idx) {
-        _e = uninitialized_fill(_chunk_a, end(), begin() + s, v);
-      }
+    /**
+     * Get a const_reference to the deque element at the given index. 
+     * @throws out_of_range exception if the index is out of bounds
+     */
+    const_reference at (size_type index) const {
+      if(index >= size())
+        throw std::out_of_range("deque");
+      return (*this)[index];
+    }
 
-      // CASE IV: Requested size is greater than existing capacity
-      else {
-        T** tmp = _table_p;
-        // Allocate a new chunk table
-        _table_p = _table_a.allocate(new_table_size);
-        uninitialized_fill(_table_a, _table_p, _table_p + new_table_size, pointer());
-
-        // Copy in the old chunk table
-        std::copy(tmp, tmp + _table_size, _table_p);
-
-        // Add necessary additional chunks and map them into the chunk table 
-        size_type num_new_chunks = new_table_size - _table_size;
-        for (size_type i = 0; i < num_new_chunks; ++ i) {
-          pointer _chunk_p = _chunk_a.allocate(CHUNK_SIZE); 
-          uninitialized_fill(_chunk_a, _chunk_p, _chunk_p + CHUNK_SIZE, v);
-          _table_p[_table_size + i] = _chunk_p;
-        }
+    // ------
+    // assign
+    // ------
+
+    /**
+     * Replace the contents of this deque with copies of the elements in
+     * [b, e). The elements must not come from this deque.
+     */
+    template <typename II,
+              typename = typename std::enable_if<!std::is_integral<II>::value>::type>
+    void assign (II b, II e) {
+      own_all();
+      assign_range(b, e, typename std::iterator_traits<II>::iterator_category());
+    }
 
-        // Destroy and Deallocate the old table
-        destroy(_table_a, tmp, tmp + _table_size);
-        _table_a.deallocate(tmp, _table_size);
+    /**
+     * Replace the contents of this deque with n copies of a value.
+     */
+    void assign (size_type n, const_reference v) {
+      // v may refer into this deque, so copy it before overwriting
+      const value_type x(v);
+      own_all();
+      assign_n(fill_iterator(x), n);
+    }
 
-        _table_size = new_table_size;
-        _l += CHUNK_SIZE * num_new_chunks;
-        _e = _b + s;
-      }
+    /**
+     * Replace the contents of this deque with the elements of an
+     * initializer list.
+     */
+    void assign (std::initializer_list<value_type> l) {
+      own_all();
+      assign_n(l.begin(), l.size());
+    }
+
+    // ------
+    // append
+    // ------
+
+    /**
+     * Append copies of the elements in [b, e), which must not come from
+     * this deque. A forward range is measured first, so chunks are mapped
+     * in once and filled a chunk at a time, with one memcpy per chunk for
+     * trivially copyable elements from contiguous memory or a my_deque.
+     */
+    template <typename II,
+              typename = typename std::enable_if<!std::is_integral<II>::value>::type>
+    void append (II b, II e) {
+      own_back();
+      append_range(b, e, typename std::iterator_traits<II>::iterator_category());
       assert(valid());
     }
-    
-    // TODO: COMMENT OUT AFTER DEV
-    // void printChunkTable() {
-    //   cout << "Chunk table has " << _table_size << " entries: " << endl;
-    //   for (size_t i = 0; i < _table_size; ++i) {
-    //     cout << "\t" << i << ": " << _table_p[i] << endl; 
-    //   }
-    // } 
 
-      
     // ----
-    // size
+    // back
     // ----
 
     /**
-     * Return the number of elements in this deque. 
+     * Access the last element
      */
-    size_type size () const {
-      return _e._idx - _b._idx;
+    reference back () {
+      assert(!empty());
+      own_at(size() - 1);
+      typename my_deque::iterator e = _e;
+      --e;
+      return *e;
     }
 
-    // ----
-    // swap
-    // ----
+    /**
+     * Return a non-modifiable reference to the last element of this deque. 
+     */
+    const_reference back () const {
+      assert(!empty());
+      const_iterator e = end();
+      --e;
+      return *e;
+    }
+
+    // -----
+    // begin
+    // -----
 
     /**
-     * Exchanges the contents of this deque with those of other. 
-     * Does not invoke any move, copy, or swap operations on individual elements.
+     * Return an iterator to the beginning of this deque.
      */
-    void swap (my_deque& that) {
-      if(_chunk_a == that._chunk_a) {
-         std::swap(_b._idx, that._b._idx);
-         std::swap(_e._idx, that._e._idx);
-         std::swap(_l._idx, that._l._idx);
-        
-         std::swap(_table_a, that._table_a);
-         std::swap(_b_table_idx, that._b_table_idx);
-         std::swap(_b_chunk_idx, that._b_chunk_idx);
-         std::swap(_table_size, that._table_size);
+    iterator begin () {
+      own_all();
+      return _b;
+    }
 
-         T** p1 = _table_p;
-         T** p2 = that._table_p;
-         std::swap(_table_p, that._table_p);
-         assert(_table_p == p2);
-         assert(that._table_p == p1);
-         assert(begin()._idx == 0);
-      }
-      else {
-        my_deque x(*this);
-        *this = that;
-        that = x;
-      }
+    /**
+     * Return a const_iterator to the beginning of this deque.
+     */
+    const_iterator begin () const {
+      return const_iterator(_b);
+    }
+
+    // -----
+    // clear
+    // -----
+
+    /**
+     * Remove all elements from this deque. 
+     */
+    void clear () {
+      truncate(0);
       assert(valid());
-  }
+    }
+
+    // -----
+    // count
+    // -----
+
+    /**
+     * Count the elements equal to v, a chunk at a time with SIMD kernels
+     * for arithmetic types (see deque_scan).
+     */
+    size_type count (const_reference v) const {
+      size_type n = 0;
+      for_segments(0, size(), [&n, &v] (const_pointer b, const_pointer e) {
+          n += deque_scan<deque_simd_count>(b, e, v);});
+      return n;
+    }
+
+    // -----------
+    // drain_front
+    // -----------
+
+    /**
+     * Move up to n elements, as many as there are, from the front of this
+     * deque to x a chunk at a time, then remove them.
+     * @return x past the last element moved
+     */
+    template <typename OI>
+    OI drain_front (size_type n, OI x) {
+      n = std::min(n, size());
+      iterator i = _b;
+      for (size_type k = n; k; ) {
+        const size_type j = std::min<size_type>(k, i._last - i._cur);
+        x = std::move(i._cur, i._cur + j, x);
+        i += j;
+        k -= j;
+      }
+      pop_front_n(n);
+      return x;
+    }
+
+#ifdef DEQUE_POSIX
+    // --------
+    // drain_to
+    // --------
+
+    /**
+     * Write up to n elements from the front of this deque to fd with one
+     * writev straight from their chunks, then remove the ones written. If
+     * fd takes only part of an element, the rest of it is written before
+     * returning, so that only whole elements leave.
+     * @return The number of elements written, or -1 if fd is non-blocking
+     *         and can't take any now
+     * @throw std::system_error on any other I/O error
+     */
+    ssize_t drain_to (int fd, size_type n = size_type(-1)) {
+      static_assert(std::is_trivially_copyable<value_type>::value,
+                    "drain_to needs a trivially copyable T");
+      n = std::min(n, size());
+      if (!n)
+        return 0;
+      iovec v[deque_iov_max];
+      iterator  i = _b;
+      size_type m = n;
+      const ssize_t r = transfer_once(fd, v, gather(i, m, v), true);
+      if (r < 0)
+        return -1;
+      const size_type k = r / sizeof(value_type);
+      if (const size_type part = r % sizeof(value_type)) {
+        v[0] = iovec{reinterpret_cast<char*>((_b + k)._cur) + part, sizeof(value_type) - part};
+        deque_transfer(fd, v, 1, true);
+        pop_front_n(k + 1);
+        return k + 1;}
+      pop_front_n(k);
+      return k;
+    }
+#endif
+
+    // -------
+    // emplace
+    // -------
+
+    /**
+     * Construct an element from args before the location pointed to by
+     * the given iterator.
+     * @param i An iterator specifying the insert position.
+     * @param args Arguments for the element's constructor
+     * @return An iterator pointing to the new element
+     */
+    template <typename... Args>
+    iterator emplace (iterator i, Args&&... args) {
+      i = own_all(i);
+      if (i == _e) {
+        emplace_back(std::forward<Args>(args)...);
+        return _e - 1;
+      }
+      if (i == _b) {
+        emplace_front(std::forward<Args>(args)...);
+        return _b;
+      }
+      // args may refer into this deque, so construct before shifting
+      value_type x(std::forward<Args>(args)...);
+      // Growing may move the chunk table, so hold on to an index instead
+      const difference_type d = i - _b;
+      if (d < difference_type(size()) - d) {
+        // Closer to the front: shift the first d elements down one slot
+        emplace_front(std::move(front()));
+        i = _b + d;
+        std::move(_b + 2, i + 1, _b + 1);
+      }
+      else {
+        emplace_back(std::move(back()));
+        i = _b + d;
+        std::move_backward(i, _e - 2, _e - 1);
+      }
+      *i = std::move(x);
+      assert(valid()); 
+      return i;
+    }
+
+    /**
+     * Construct an element from args at the end of the deque.
+     * @param args Arguments for the element's constructor
+     * @return A reference to the new element
+     */
+    template <typename... Args>
+    reference emplace_back (Args&&... args) {
+      own_back();
+      if (!_b._node)
+        add_first_chunk(0);
+      // Keep _e inside an allocated chunk
+      if ((_e._cur + 1 == _e._last) && (_e._node + 1 == _table_p + _c_last))
+        add_chunk_back();
+      construct_back(std::forward<Args>(args)...);
+      assert(valid());
+      return back();
+    }
+
+    /**
+     * Construct an element from args at the front of the deque.
+     * @param args Arguments for the element's constructor
+     * @return A reference to the new element
+     */
+    template <typename... Args>
+    reference emplace_front (Args&&... args) {
+      own_front();
+      if (!_b._node)
+        add_first_chunk(chunk_size - 1);
+      if ((_b._cur == _b._first) && (_b._node == _table_p + _c_first))
+        add_chunk_front();
+      iterator b = _b;
+      --b;
+      allocator_traits::construct(_chunk_a, b._cur, std::forward<Args>(args)...); 
+      _b = b;
+      note_size();
+      assert(valid());
+      return front();
+    }
+
+    // -----
+    // empty
+    // -----
+
+    /**
+     * Determine if this elements has no elements. 
+     */
+    bool empty () const {
+      return !size();
+    }
+
+    // ---
+    // end
+    // ---
+
+    /**
+     * Return an iterator to the end of this deque.
+     */
+    iterator end () {
+      own_all();
+      return _e;
+    }
+
+    /**
+     * Return an const_iterator to the end of this deque.
+     */
+    const_iterator end () const {
+      return const_iterator(_e);
+    }
+
+    // -----
+    // erase
+    // -----
+
+    /**
+     * Removes the element at the position indicated by the given iterator. 
+     * @return An iterator to the element that followed the removed one
+     */
+    iterator erase (iterator i) {
+      return erase(i, i + 1);
+    }
+
+    /**
+     * Removes the elements in [b, e), closing the gap from whichever side
+     * has fewer elements to move.
+     * @return An iterator to the element that followed the removed ones
+     */
+    iterator erase (iterator b, iterator e) {
+      const difference_type n = e - b;
+      b = own_all(b);
+      e = b + n;
+      const difference_type d = b - _b;
+      if (!n)
+        return b;
+      if (d < difference_type(size()) - d - n) {
+        std::move_backward(_b, b, e);
+        const iterator x = _b + n;
+        destroy(_chunk_a, _b, x);
+        _b = x;
+        trim_spares(_max_spare);
+      }
+      else {
+        std::move(e, _e, b);
+        truncate(size() - n);
+      }
+      assert(valid());
+      return _b + d;
+    }
+
+#ifdef DEQUE_POSIX
+    // ---------
+    // fill_from
+    // ---------
+
+    /**
+     * Append up to n elements read from fd with one readv straight into
+     * the chunks at the back, mapping them in first. If fd gives only
+     * part of an element, the rest of it is read before returning, so
+     * that only whole elements are added.
+     * @return The number of elements added, 0 at end of file, or -1 if fd
+     *         is non-blocking and has nothing to read now
+     * @throw std::system_error on any other I/O error, std::runtime_error
+     *        if end of file comes in the middle of an element
+     */
+    ssize_t fill_from (int fd, size_type n) {
+      static_assert(std::is_trivially_copyable<value_type>::value,
+                    "fill_from needs a trivially copyable T");
+      if (!n)
+        return 0;
+      own_back();
+      reserve_back(size() + n);
+      iovec v[deque_iov_max];
+      iterator  i = _e;
+      size_type m = n;
+      const ssize_t r = transfer_once(fd, v, gather(i, m, v), false);
+      if (r < 0)
+        return -1;
+      size_type k = r / sizeof(value_type);
+      if (const size_type part = r % sizeof(value_type)) {
+        v[0] = iovec{reinterpret_cast<char*>((_e + k)._cur) + part, sizeof(value_type) - part};
+        deque_transfer(fd, v, 1, false);
+        ++k;}
+      _e += k;
+      note_size();
+      trim_spares(_max_spare);
+      assert(valid());
+      return k;
+    }
+#endif
+
+    // ----
+    // find
+    // ----
+
+    /**
+     * Find the first element equal to v, a chunk at a time with SIMD
+     * kernels for arithmetic types (see deque_scan).
+     * @return An iterator to it, or end() if there is none
+     */
+    iterator find (const_reference v) {
+      own_all();
+      return _b + (static_cast<const my_deque&>(*this).find(v) - const_iterator(_b));
+    }
+
+    const_iterator find (const_reference v) const {
+      iterator i = _b;
+      while (i != _e) {
+        const_pointer e = (i._node == _e._node) ? _e._cur : i._last;
+        const_pointer p = deque_scan<deque_simd_find>(i._cur, e, v);
+        if (p != e)
+          return i + (p - i._cur);
+        i += e - i._cur;
+      }
+      return _e;
+    }
+
+    // -----
+    // front
+    // -----
+
+    /**
+     * Returns a reference to the first element in the deque. 
+     */
+    reference front () {
+      assert(!empty());
+      own_at(0);
+      return *_b;
+    }
+
+    /**
+     * Returns a non-modifiable reference to the first element in the deque. 
+     */
+    const_reference front () const {
+      assert(!empty());
+      return *begin();
+    }
+
+    // -------------
+    // get_allocator
+    // -------------
+
+    /**
+     * Return a copy of the allocator this deque allocates chunks with.
+     */
+    allocator_type get_allocator () const {
+      return _chunk_a;
+    }
+
+    // ------
+    // insert
+    // ------
+
+    /**
+     * Insert the a value before the location pointed to by the given iterator
+     * @param i An iterator specifying the insert position.
+     * @param v The element to insert
+     * @return An iterator pointing to the inserted value
+     */
+    iterator insert (iterator i, const_reference v) {
+      return emplace(i, v);
+    }
+
+    /**
+     * Move the a value in before the location pointed to by the given iterator
+     * @param i An iterator specifying the insert position.
+     * @param v The element to insert
+     * @return An iterator pointing to the inserted value
+     */
+    iterator insert (iterator i, value_type&& v) {
+      return emplace(i, std::move(v));
+    }
+
+    /**
+     * Insert n copies of a value before the location pointed to by the
+     * given iterator, moving whichever side of it is shorter out of the way.
+     * @param i An iterator specifying the insert position.
+     * @param n The number of copies to insert
+     * @param v The value to copy
+     * @return An iterator pointing to the first inserted element
+     */
+    iterator insert (iterator i, size_type n, const_reference v) {
+      // v may refer into this deque, so copy it before shifting
+      const value_type x(v);
+      own_all();
+      return insert_n(i - _b, n, fill_iterator(x));
+    }
+
+    /**
+     * Insert copies of the elements in [b, e) before the location pointed
+     * to by the given iterator, moving whichever side of it is shorter out
+     * of the way.
+     * @param i An iterator specifying the insert position.
+     * @return An iterator pointing to the first inserted element
+     */
+    template <typename II,
+              typename = typename std::enable_if<!std::is_integral<II>::value>::type>
+    iterator insert (iterator i, II b, II e) {
+      i = own_all(i);
+      return insert_range(i, b, e,
+                          typename std::iterator_traits<II>::iterator_category());
+    }
+
+    // ----------------
+    // max_spare_chunks
+    // ----------------
+
+    /**
+     * Most chunks emptied by pops that this deque keeps for reuse by
+     * later pushes at either end before giving them back.
+     */
+    size_type max_spare_chunks () const {
+      return _max_spare;
+    }
+
+    /**
+     * Set the high-water mark for spare chunks, trimming down to it now.
+     * 0 gives every emptied chunk straight back; a large value keeps
+     * every chunk a burst ever needed.
+     * @param n The most spare chunks to keep
+     */
+    void max_spare_chunks (size_type n) {
+      _max_spare = n;
+      trim_spares(n);
+      assert(valid());
+    }
+
+    // ------
+    // minmax
+    // ------
+
+    /**
+     * The smallest and largest elements, which must exist, a chunk at a
+     * time with SIMD kernels for arithmetic types (see deque_scan).
+     */
+    std::pair<value_type, value_type> minmax () const {
+      assert(!empty());
+      std::pair<value_type, value_type> r(front(), front());
+      for_segments(0, size(), [&r] (const_pointer b, const_pointer e) {
+          const std::pair<value_type, value_type> t = deque_scan<deque_simd_minmax>(b, e);
+          if (t.first < r.first)
+            r.first = t.first;
+          if (r.second < t.second)
+            r.second = t.second;});
+      return r;
+    }
+
+    // -----------------
+    // parallel_count_if
+    // -----------------
+
+    /**
+     * Count the elements that satisfy p, spreading whole chunks across up
+     * to threads threads (0 for one per core).
+     */
+    template <typename P>
+    size_type parallel_count_if (P p, unsigned threads = 0) const {
+      const size_type runs = parallel_runs(threads);
+      std::vector<size_type> counts(runs, 0);
+      parallel_ranges(runs, [this, &p, &counts] (size_type w, size_type lo, size_type hi) {
+          P q = p;
+          size_type n = 0;
+          for_segments(lo, hi, [&q, &n] (const_pointer b, const_pointer e) {
+              for (; b != e; ++b)
+                if (q(*b))
+                  ++n;});
+          counts[w] = n;});
+      return std::accumulate(counts.begin(), counts.end(), size_type(0));
+    }
+
+    // -----------------
+    // parallel_for_each
+    // -----------------
+
+    /**
+     * Call f on every element, spreading whole chunks across up to threads
+     * threads (0 for one per core). Each thread calls its own copy of f,
+     * and there is no order between elements of different chunks.
+     */
+    template <typename F>
+    void parallel_for_each (F f, unsigned threads = 0) {
+      own_all();
+      parallel_ranges(parallel_runs(threads), [this, &f] (size_type, size_type lo, size_type hi) {
+          F g = f;
+          for_segments(lo, hi, [&g] (pointer b, pointer e) {
+              for (; b != e; ++b)
+                g(*b);});});
+    }
+
+    // ---------------
+    // parallel_reduce
+    // ---------------
+
+    /**
+     * Fold the elements into init with op, spreading whole chunks across up
+     * to threads threads (0 for one per core). op must be associative;
+     * each thread folds its run left to right, and the runs are then
+     * folded into init in order.
+     */
+    template <typename U, typename Op>
+    U parallel_reduce (U init, Op op, unsigned threads = 0) const {
+      const size_type runs = parallel_runs(threads);
+      std::vector<U>    parts(runs, init);
+      std::vector<char> used(runs, 0);
+      parallel_ranges(runs, [this, &op, &parts, &used] (size_type w, size_type lo, size_type hi) {
+          if (lo == hi)
+            return;
+          U&  x     = parts[w];
+          Op  g     = op;
+          bool first = true;
+          for_segments(lo, hi, [&x, &g, &first] (const_pointer b, const_pointer e) {
+              if (first) {
+                x = *b++;
+                first = false;}
+              for (; b != e; ++b)
+                x = g(x, *b);});
+          used[w] = 1;});
+      for (size_type w = 0; w != runs; ++w)
+        if (used[w])
+          init = op(init, parts[w]);
+      return init;
+    }
+
+    // ------------------
+    // parallel_transform
+    // ------------------
+
+    /**
+     * Store f(x) for every element x into the same position of out, which
+     * must have at least as many elements as this deque and may be this
+     * deque. Whole chunks are spread across up to threads threads (0 for
+     * one per core).
+     */
+    template <typename D, typename F>
+    void parallel_transform (D& out, F f, unsigned threads = 0) const {
+      assert(out.size() >= size());
+      parallel_ranges(parallel_runs(threads), [this, &out, &f] (size_type, size_type lo, size_type hi) {
+          F g = f;
+          typename D::iterator o = out.begin() + lo;
+          for_segments(lo, hi, [&g, &o] (const_pointer b, const_pointer e) {
+              for (; b != e; ++b, ++o)
+                *o = g(*b);});});
+    }
+
+  private:
+    // -------------
+    // parallel_runs
+    // -------------
+
+    /**
+     * How many runs of whole chunks to split the elements into for up to
+     * threads threads (0 for one per core): never more than there are
+     * chunks, and at least one.
+     */
+    size_type parallel_runs (unsigned threads) const {
+      if (!threads)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+      const size_type chunks = (chunk_offset() + size() + chunk_size - 1) >> chunk_shift;
+      return std::max<size_type>(1, std::min<size_type>(threads, chunks));
+    }
+
+    /**
+     * Where the first element sits in its chunk.
+     */
+    size_type chunk_offset () const {
+      return _b._node ? (_b._cur - _b._first) : 0;
+    }
+
+    // ---------------
+    // parallel_ranges
+    // ---------------
+
+    /**
+     * Split the elements into runs consecutive runs of whole chunks and
+     * call f(w, lo, hi) for each run w, covering indices [lo, hi), each on
+     * its own thread; the calling thread takes run 0. The first exception
+     * thrown by a run is rethrown here once every run is done.
+     */
+    template <typename F>
+    void parallel_ranges (size_type runs, F f) const {
+      const size_type off = chunk_offset();
+      const size_type s   = size();
+      const size_type per = (((off + s + chunk_size - 1) >> chunk_shift) + runs - 1) / runs;
+
+      std::exception_ptr error;
+      std::mutex         m;
+      auto run = [&] (size_type w) {
+          const size_type lo = w ? std::min(s, w * per * chunk_size - off) : 0;
+          const size_type hi = std::min(s, (w + 1) * per * chunk_size - off);
+          try {
+            f(w, lo, hi);
+          }
+          catch (...) {
+            std::lock_guard<std::mutex> g(m);
+            if (!error)
+              error = std::current_exception();
+          }};
+
+      std::vector<std::thread> ts;
+      try {
+        for (size_type w = 1; w < runs; ++w)
+          ts.push_back(std::thread(run, w));
+      }
+      catch (...) {
+        // Couldn't start another thread: do the remaining runs here
+        for (size_type w = ts.size() + 1; w < runs; ++w)
+          run(w);
+      }
+      run(0);
+      for (std::thread& t : ts)
+        t.join();
+      if (error)
+        std::rethrow_exception(error);
+    }
+
+    // ------------
+    // for_segments
+    // ------------
+
+    /**
+     * Call g(b, e) for each contiguous piece [b, e) of the elements at
+     * indices [lo, hi), in order: one per chunk.
+     */
+    template <typename G>
+    void for_segments (size_type lo, size_type hi, G g) const {
+      if (lo >= hi)
+        return;
+      iterator       i = _b + lo;
+      const iterator e = i + (hi - lo);
+      while (i._node != e._node) {
+        deque_prefetch(i._node[1]);
+        g(i._cur, i._last);
+        i += i._last - i._cur;
+      }
+      g(i._cur, e._cur);
+    }
+
+  public:
+
+    // ---
+    // pop
+    // ---
+
+    /**
+     * Removes the last element of the deque. 
+     */
+    void pop_back () {
+      assert(!empty());
+      const bool hop = (_e._cur == _e._first);
+      --_e;
+      allocator_traits::destroy(_chunk_a, _e._cur);
+      if (hop)
+        trim_spares(_max_spare);
+      assert(valid());
+    }
+
+    /**
+     * Removes the first element of this deque. 
+     */
+    void pop_front () {
+      assert(!empty());
+      allocator_traits::destroy(_chunk_a, _b._cur);
+      ++_b;
+      if (_b._cur == _b._first)
+        trim_spares(_max_spare);
+      assert(valid());
+    }
+
+    /**
+     * Remove the last n elements, a chunk at a time.
+     */
+    void pop_back_n (size_type n) {
+      assert(n <= size());
+      truncate(size() - n);
+      assert(valid());
+    }
+
+    /**
+     * Remove the first n elements, a chunk at a time.
+     */
+    void pop_front_n (size_type n) {
+      assert(n <= size());
+      const iterator b = _b + n;
+      destroy_segments(_b, b);
+      _b = b;
+      trim_spares(_max_spare);
+      assert(valid());
+    }
+
+    // -------
+    // prepend
+    // -------
+
+    /**
+     * Insert copies of the elements in [b, e), which must not come from
+     * this deque, at the front, in order, so that front() is a copy of
+     * *b. Chunks are mapped in once and filled a chunk at a time. If a
+     * copy throws, this deque is left as it was.
+     */
+    template <typename II,
+              typename = typename std::enable_if<!std::is_integral<II>::value>::type>
+    void prepend (II b, II e) {
+      own_front();
+      prepend_range(b, e, typename std::iterator_traits<II>::iterator_category());
+      assert(valid());
+    }
+
+    // ----
+    // push
+    // ----
+
+    /**
+     * Appends the given element value to the end of the deque. 
+     * @param v The element value
+     * @return void
+     */
+    void push_back (const_reference v) {
+      emplace_back(v);
+    }
+
+    /**
+     * Moves the given element value onto the end of the deque. 
+     * @param v The element value
+     * @return void
+     */
+    void push_back (value_type&& v) {
+      emplace_back(std::move(v));
+    }
+
+    /**
+     * Appends the given element value to the front of the deque. 
+     * @param v The element value
+     * @return void
+     */
+    void push_front (const_reference v) {
+      emplace_front(v);
+    }
+
+    /**
+     * Moves the given element value onto the front of the deque. 
+     * @param v The element value
+     * @return void
+     */
+    void push_front (value_type&& v) {
+      emplace_front(std::move(v));
+    }
+
+#ifdef DEQUE_POSIX
+    // -------------
+    // read_snapshot
+    // -------------
+
+    /**
+     * Replace the contents of this deque with a snapshot from fd (see
+     * write_snapshot). The elements are read straight into the chunks, a
+     * batch of chunks per readv, without a copy per element.
+     * @throw std::runtime_error if fd doesn't hold a snapshot of elements
+     *        of this size, std::system_error on an I/O error; either way
+     *        this deque is left empty
+     */
+    void read_snapshot (int fd) {
+      static_assert(std::is_trivially_copyable<value_type>::value,
+                    "read_snapshot needs a trivially copyable T");
+      own_all();
+      clear();
+      deque_snapshot_header h;
+      iovec v[deque_iov_max];
+      v[0] = iovec{&h, sizeof(h)};
+      deque_transfer(fd, v, 1, false);
+      deque_snapshot_check(h, sizeof(value_type));
+
+      reserve_back(h.size);
+      iterator  i = _e;
+      size_type m = h.size;
+      while (m)
+        deque_transfer(fd, v, gather(i, m, v), false);
+      _e = i;
+      note_size();
+      assert(valid());
+    }
+#endif
+
+    // ------
+    // resize
+    // ------
+
+    /**
+     * Resizes the deque to contain s elements. If the current size is 
+     * greater than s, the container is reduced to its first count 
+     * elements as if by repeatedly calling pop_back(). 
+     * @param s The desired new size of this container.
+     * @return void
+     */
+    void resize (size_type s) {
+      if (s <= size())
+        truncate(s);
+      else {
+        own_back();
+        reserve_back(s);
+        for (size_type n = s - size(); n; --n)
+          construct_back();
+      }
+      assert(valid());
+    }
+
+    /**
+     * Resizes the deque to contain s elements. If the current size is 
+     * greater than s, the container is reduced to its first count 
+     * elements as if by repeatedly calling pop_back(). 
+     * @param s The desired new size of this container.
+     * @param v The value to assign elements if expanding size.
+     * @return void
+     */
+    void resize (size_type s, const_reference v) {
+      if (s <= size())
+        truncate(s);
+      else {
+        own_back();
+        reserve_back(s);
+        for (size_type n = s - size(); n; --n)
+          construct_back(v);
+      }
+      assert(valid());
+    }
+    
+  private:
+    // --------------
+    // construct_back
+    // --------------
+
+    /**
+     * Construct an element from args in the slot at _e, which must have
+     * room behind it (see reserve_back), and make it part of this deque.
+     */
+    template <typename... Args>
+    void construct_back (Args&&... args) {
+      allocator_traits::construct(_chunk_a, _e._cur, std::forward<Args>(args)...);
+      ++_e;
+      note_size();
+    }
+
+    // ---------
+    // note_size
+    // ---------
+
+    /**
+     * Raise the peak size stats() reports to size(), if DEQUE_STATS is
+     * defined. Called wherever this deque grows.
+     */
+    void note_size () {
+      DEQUE_STAT(_counters.peak_size = std::max(_counters.peak_size, size()));
+    }
+
+    // ----------------
+    // construct_back_n
+    // ----------------
+
+    /**
+     * Construct copies of the n elements starting at x at the back, one
+     * destination chunk at a time. Room must already be reserved.
+     * @return An iterator past the last element copied
+     */
+    template <typename II>
+    II construct_back_n (II x, size_type n) {
+      while (n) {
+        const size_type k = std::min<size_type>(n, _e._last - _e._cur);
+        x = construct_segment(x, k);
+        n -= k;
+      }
+      note_size();
+      return x;
+    }
+
+    // -----------------
+    // construct_segment
+    // -----------------
+
+    /**
+     * Construct copies of the k elements starting at x at the back. The k
+     * slots lie in one chunk. Contiguous runs of trivially copyable
+     * elements are copied with a single memcpy.
+     * @return An iterator past the last element copied
+     */
+    template <typename II>
+    II construct_segment (II x, size_type k) {
+      for (; k; --k, ++x)
+        construct_back(*x);
+      return x;
+    }
+
+    const_pointer construct_segment (const_pointer x, size_type k) {
+      return construct_segment(x, k, std::is_trivially_copyable<value_type>());
+    }
+
+    pointer construct_segment (pointer x, size_type k) {
+      return const_cast<pointer>(construct_segment(const_cast<const_pointer>(x), k));
+    }
+
+    const_iterator construct_segment (const_iterator x, size_type k) {
+      // Another deque's elements are contiguous up to the end of its chunk
+      while (k) {
+        const size_type j = std::min<size_type>(k, x._last - x._cur);
+        construct_segment(const_cast<const_pointer>(x._cur), j);
+        x += j;
+        k -= j;
+      }
+      return x;
+    }
+
+    iterator construct_segment (iterator x, size_type k) {
+      return x + (construct_segment(const_iterator(x), k) - const_iterator(x));
+    }
+
+    const_pointer construct_segment (const_pointer x, size_type k, std::true_type) {
+      std::memcpy(static_cast<void*>(_e._cur), x, k * sizeof(value_type));
+      _e += k;
+      return x + k;
+    }
+
+    const_pointer construct_segment (const_pointer x, size_type k, std::false_type) {
+      return construct_segment<const_pointer>(x, k);
+    }
+
+    // ------------
+    // assign_range
+    // ------------
+
+    /**
+     * Single pass ranges can't be measured up front, so assign over the
+     * elements there are and then append the rest.
+     */
+    template <typename II>
+    void assign_range (II b, II e, std::input_iterator_tag) {
+      iterator i = _b;
+      for (; (i != _e) && (b != e); ++i, ++b)
+        *i = *b;
+      truncate(i - _b);
+      for (; b != e; ++b)
+        emplace_back(*b);
+    }
+
+    template <typename FI>
+    void assign_range (FI b, FI e, std::forward_iterator_tag) {
+      assign_n(b, std::distance(b, e));
+    }
+
+    // --------
+    // assign_n
+    // --------
+
+    /**
+     * Replace the contents of this deque with the n elements starting at x,
+     * growing the table at most once. Trivially copyable elements need no
+     * destruction, so they are all overwritten a chunk at a time, like new
+     * ones; other elements are assigned over and the rest constructed.
+     */
+    template <typename FI>
+    void assign_n (FI x, size_type n) {
+      size_type m = 0;
+      if (std::is_trivially_copyable<value_type>::value)
+        _e = _b;
+      else {
+        m = std::min(n, size());
+        const iterator e = _b + m;
+        for (iterator i = _b; i != e; ++i, ++x)
+          *i = *x;
+      }
+      if (n > size()) {
+        reserve_back(n);
+        construct_back_n(x, n - m);
+      }
+      // Destroys nothing when growing; gives back spares either way
+      truncate(n);
+      assert(valid());
+    }
+
+    // --------
+    // truncate
+    // --------
+
+    /**
+     * Destroy every element from index s on.
+     */
+    void truncate (size_type s) {
+      iterator e = _b + s;
+      destroy_segments(e, _e);
+      _e = e;
+      trim_spares(_max_spare);
+    }
+
+    // ----------------
+    // destroy_segments
+    // ----------------
+
+    /**
+     * Destroy the elements in [b, e) a chunk at a time; nothing to do for
+     * trivially destructible ones.
+     */
+    void destroy_segments (iterator b, iterator e) {
+      if (std::is_trivially_destructible<value_type>::value)
+        return;
+      while (b != e) {
+        const size_type k = (b._node == e._node) ? e._cur - b._cur : b._last - b._cur;
+        destroy(_chunk_a, b._cur, b._cur + k);
+        b += k;
+      }
+    }
+
+    // ------------
+    // append_range
+    // ------------
+
+    template <typename II>
+    void append_range (II b, II e, std::input_iterator_tag) {
+      for (; b != e; ++b)
+        emplace_back(*b);
+    }
+
+    template <typename FI>
+    void append_range (FI b, FI e, std::forward_iterator_tag) {
+      const size_type n = std::distance(b, e);
+      reserve_back(size() + n);
+      construct_back_n(b, n);
+    }
+
+    // -------------
+    // prepend_range
+    // -------------
+
+    template <typename II>
+    void prepend_range (II b, II e, std::input_iterator_tag) {
+      // Can't count a single pass range up front: append and rotate
+      my_deque x(get_allocator());
+      x.append(b, e);
+      prepend_range(std::make_move_iterator(x.begin()), std::make_move_iterator(x.end()),
+                    std::forward_iterator_tag());
+    }
+
+    template <typename FI>
+    void prepend_range (FI x, FI e, std::forward_iterator_tag) {
+      if (!_b._node)
+        return append_range(x, e, std::forward_iterator_tag());
+      const size_type n = std::distance(x, e);
+      reserve_front(n);
+      const iterator b = _b - n;
+      iterator       i = b;
+      try {
+        while (i != _b) {
+          const size_type k = std::min<size_type>(_b - i, i._last - i._cur);
+          x = copy_segment(x, i._cur, k);
+          i += k;
+        }
+      }
+      catch (...) {
+        destroy(_chunk_a, b, i);
+        throw;
+      }
+      _b = b;
+      note_size();
+    }
+
+    // ------------
+    // copy_segment
+    // ------------
+
+    /**
+     * Construct copies of the k elements starting at x in the raw slots
+     * starting at d, which lie in one chunk, with a single memcpy for
+     * trivially copyable elements from contiguous memory. If a copy
+     * throws, the ones made so far are destroyed.
+     * @return An iterator past the last element copied
+     */
+    template <typename II>
+    II copy_segment (II x, pointer d, size_type k) {
+      pointer p = d;
+      try {
+        for (; k; --k, ++x, ++p)
+          allocator_traits::construct(_chunk_a, p, *x);
+      }
+      catch (...) {
+        destroy(_chunk_a, d, p);
+        throw;
+      }
+      return x;
+    }
+
+    const_pointer copy_segment (const_pointer x, pointer d, size_type k) {
+      return copy_segment(x, d, k, std::is_trivially_copyable<value_type>());
+    }
+
+    pointer copy_segment (pointer x, pointer d, size_type k) {
+      return const_cast<pointer>(copy_segment(const_cast<const_pointer>(x), d, k));
+    }
+
+    const_iterator copy_segment (const_iterator x, pointer d, size_type k) {
+      // Another deque's elements are contiguous up to the end of its chunk
+      const pointer s = d;
+      try {
+        while (k) {
+          const size_type j = std::min<size_type>(k, x._last - x._cur);
+          copy_segment(const_cast<const_pointer>(x._cur), d, j);
+          x += j;
+          d += j;
+          k -= j;
+        }
+      }
+      catch (...) {
+        destroy(_chunk_a, s, d);
+        throw;
+      }
+      return x;
+    }
+
+    iterator copy_segment (iterator x, pointer d, size_type k) {
+      return x + (copy_segment(const_iterator(x), d, k) - const_iterator(x));
+    }
+
+    const_pointer copy_segment (const_pointer x, pointer d, size_type k, std::true_type) {
+      std::memcpy(static_cast<void*>(d), x, k * sizeof(value_type));
+      return x + k;
+    }
+
+    const_pointer copy_segment (const_pointer x, pointer d, size_type k, std::false_type) {
+      return copy_segment<const_pointer>(x, d, k);
+    }
+
+    // ------------
+    // reserve_back
+    // ------------
+
+    /**
+     * Map in enough chunks at the back to hold s elements (keeping _e
+     * inside one), growing the table at most once.
+     */
+    void reserve_back (size_type s) {
+      if (!_b._node)
+        add_first_chunk(0);
+      if (s >= capacity()) {
+        const size_type chunks = (((_b._cur - _b._first) + s) >> chunk_shift) + 1;
+        size_type n = chunks - (_table_p + _c_last - _b._node);
+        reserve_table(0, n);
+        while (n--)
+          add_chunk_back();
+      }
+    }
+
+    // -------------
+    // reserve_front
+    // -------------
+
+    /**
+     * Map in enough chunks at the front to hold n more elements before _b,
+     * growing the table at most once.
+     */
+    void reserve_front (size_type n) {
+      const size_type room =
+          (_b._node - (_table_p + _c_first)) * chunk_size + (_b._cur - _b._first);
+      if (n > room) {
+        size_type k = (n - room + chunk_size - 1) >> chunk_shift;
+        reserve_table(k, 0);
+        while (k--)
+          add_chunk_front();
+      }
+    }
+
+    // -------------
+    // fill_iterator
+    // -------------
+
+    /**
+     * A forward iterator that yields the same value over and over, so that
+     * insert(i, n, v) can share insert_n with the range insert.
+     */
+    class fill_iterator {
+      public:
+        typedef std::forward_iterator_tag          iterator_category;
+        typedef typename my_deque::value_type      value_type;
+        typedef typename my_deque::difference_type difference_type;
+        typedef typename my_deque::const_pointer   pointer;
+        typedef typename my_deque::const_reference reference;
+
+        explicit fill_iterator (const_reference v, size_type i = 0) :
+            _v(&v),
+            _i(i) {}
+
+        friend bool operator == (const fill_iterator& lhs, const fill_iterator& rhs) {
+          return lhs._i == rhs._i;}
+
+        friend bool operator != (const fill_iterator& lhs, const fill_iterator& rhs) {
+          return !(lhs == rhs);}
+
+        reference operator * () const {
+          return *_v;}
+
+        fill_iterator& operator ++ () {
+          ++_i;
+          return *this;}
+
+        fill_iterator operator ++ (int) {
+          fill_iterator x = *this;
+          ++*this;
+          return x;}
+
+      private:
+        const_pointer _v;
+        size_type     _i;};
+
+    // ------------
+    // insert_range
+    // ------------
+
+    /**
+     * Single pass ranges can't be measured up front, so append them and
+     * rotate the new elements into place.
+     */
+    template <typename II>
+    iterator insert_range (iterator i, II b, II e, std::input_iterator_tag) {
+      const difference_type d = i - _b;
+      const size_type s = size();
+      try {
+        while (b != e) {
+          emplace_back(*b);
+          ++b;
+        }
+      }
+      catch (...) {
+        truncate(s);
+        throw;
+      }
+      std::rotate(_b + d, _b + s, _e);
+      return _b + d;
+    }
+
+    template <typename FI>
+    iterator insert_range (iterator i, FI b, FI e, std::forward_iterator_tag) {
+      return insert_n(i - _b, std::distance(b, e), b);
+    }
+
+    // --------
+    // insert_n
+    // --------
+
+    /**
+     * Insert the n elements starting at x before index d. Only the side of
+     * d with fewer elements moves, and it moves as one block: part of it
+     * into raw slots past the old end, the rest by assignment. The same
+     * split puts the new elements partly into raw slots, partly over
+     * moved-from ones.
+     * @return An iterator pointing to the first inserted element
+     */
+    template <typename FI>
+    iterator insert_n (difference_type d, size_type n, FI x) {
+      if (!n)
+        return _b + d;
+      const difference_type m = n;
+      if (d < difference_type(size()) - d) {
+        reserve_front(n);
+        const iterator old_b = _b;
+        const iterator new_b = _b - m;
+        if (d >= m) {
+          uninitialized_copy(_chunk_a, std::make_move_iterator(old_b),
+                             std::make_move_iterator(old_b + m), new_b);
+          _b = new_b;
+          std::move(old_b + m, old_b + d, old_b);
+          std::copy_n(x, n, old_b + (d - m));
+        }
+        else {
+          FI y = std::next(x, m - d);
+          const iterator p =
+              uninitialized_copy(_chunk_a, std::make_move_iterator(old_b),
+                                 std::make_move_iterator(old_b + d), new_b);
+          try {
+            uninitialized_copy(_chunk_a, x, y, p);
+          }
+          catch (...) {
+            destroy(_chunk_a, new_b, p);
+            throw;
+          }
+          _b = new_b;
+          std::copy_n(y, d, old_b);
+        }
+      }
+      else {
+        reserve_back(size() + n);
+        const difference_type after = size() - d;
+        const iterator i     = _b + d;
+        const iterator old_e = _e;
+        if (after >= m) {
+          uninitialized_copy(_chunk_a, std::make_move_iterator(old_e - m),
+                             std::make_move_iterator(old_e), old_e);
+          _e = old_e + m;
+          std::move_backward(i, old_e - m, old_e);
+          std::copy_n(x, n, i);
+        }
+        else {
+          FI y = std::next(x, after);
+          const iterator p =
+              uninitialized_copy(_chunk_a, y, std::next(y, m - after), old_e);
+          try {
+            uninitialized_copy(_chunk_a, std::make_move_iterator(i),
+                               std::make_move_iterator(old_e), p);
+          }
+          catch (...) {
+            destroy(_chunk_a, old_e, p);
+            throw;
+          }
+          _e = old_e + m;
+          std::copy_n(x, after, i);
+        }
+      }
+      note_size();
+      assert(valid());
+      return _b + d;
+    }
+
+  public:
+    // --------
+    // segments
+    // --------
+
+    /**
+     * A forward range over the contiguous runs of elements between two
+     * iterators of a my_deque, in order. Each is a deque_segment: all of a
+     * chunk's elements but at either end, where it may be only part of one.
+     * Valid until the deque is next changed.
+     */
+    template <typename I, typename P>
+    class segment_range {
+      public:
+        typedef deque_segment<P> value_type;
+
+        class iterator {
+          public:
+            typedef std::forward_iterator_tag iterator_category;
+            typedef deque_segment<P>          value_type;
+            typedef std::ptrdiff_t            difference_type;
+            typedef const value_type*         pointer;
+            typedef value_type                reference;
+
+          private:
+            I         _i; //! Start of the current run
+            size_type _n; //! Elements left, from _i on
+
+          public:
+            iterator (const I& i, size_type n) : _i(i), _n(n) {}
+
+            friend bool operator == (const iterator& lhs, const iterator& rhs) {
+              return lhs._n == rhs._n;}
+
+            friend bool operator != (const iterator& lhs, const iterator& rhs) {
+              return !(lhs == rhs);}
+
+            value_type operator * () const {
+              return my_deque::segment_at<P>(_i, _n);}
+
+            iterator& operator ++ () {
+              const size_type k = my_deque::segment_at<P>(_i, _n).size;
+              _i += k;
+              _n -= k;
+              return *this;}
+
+            iterator operator ++ (int) {
+              iterator x = *this;
+              ++*this;
+              return x;}};
+
+      private:
+        I         _b;
+        size_type _n;
+
+      public:
+        segment_range (const I& b, const I& e) : _b(b), _n(e - b) {}
+
+        iterator begin () const {
+          return iterator(_b, _n);}
+
+        iterator end () const {
+          return iterator(_b, 0);}
+
+        bool empty () const {
+          return !_n;}};
+
+    typedef segment_range<iterator, pointer>             segments_type;
+    typedef segment_range<const_iterator, const_pointer> const_segments_type;
+
+    /**
+     * The elements of this deque, or of [b, e), as contiguous runs, so
+     * that each chunk can be handed to a tight loop or to a library that
+     * wants pointers:
+     * for (auto s : x.segments()) h = hash(h, s.data, s.size);
+     */
+    segments_type segments () {
+      return segments_type(begin(), end());
+    }
+
+    const_segments_type segments () const {
+      return const_segments_type(begin(), end());
+    }
+
+    segments_type segments (iterator b, iterator e) {
+      const difference_type n = e - b;
+      b = own_all(b);
+      return segments_type(b, b + n);
+    }
+
+    const_segments_type segments (const_iterator b, const_iterator e) const {
+      return const_segments_type(b, e);
+    }
+
+  private:
+    /**
+     * The run starting at i with at most n elements, up to the end of i's chunk.
+     */
+    template <typename P, typename I>
+    static deque_segment<P> segment_at (const I& i, size_type n) {
+      deque_segment<P> s = {i._cur, std::min<size_type>(n, i._last - i._cur)};
+      return s;
+    }
+
+  public:
+    // -------------
+    // shrink_to_fit
+    // -------------
+
+    /**
+     * Give every spare chunk back to the allocator and shrink the chunk
+     * table to the chunks that hold elements.
+     */
+    void shrink_to_fit () {
+      if (!_b._node)
+        return;
+      trim_spares(0);
+      const size_type used = _c_last - _c_first;
+      // An inline table costs nothing to keep
+      if ((used < _table_size) && !inline_buffer::owns_table(_table_p)) {
+        T** new_table = allocate_table(used);
+        std::copy(_table_p + _c_first, _table_p + _c_last, new_table);
+        rebase(new_table - _c_first);
+        deallocate_table(_table_p, _table_size);
+        _table_p    = new_table;
+        _table_size = used;
+        _c_first    = 0;
+        _c_last     = used;
+        DEQUE_STAT(++_counters.table_reallocations);
+      }
+      assert(valid());
+    }
+
+    // TODO: COMMENT OUT AFTER DEV
+    // void printChunkTable() {
+    //   cout << "Chunk table has " << _table_size << " entries: " << endl;
+    //   for (size_t i = 0; i < _table_size; ++i) {
+    //     cout << "\t" << i << ": " << _table_p[i] << endl; 
+    //   }
+    // } 
+
+      
+    // ----
+    // size
+    // ----
+
+    /**
+     * Return the number of elements in this deque. 
+     */
+    size_type size () const {
+      return _e - _b;
+    }
+
+    // -----
+    // stats
+    // -----
+
+    /**
+     * Chunk, slot and byte counts for this deque, plus its reallocation
+     * counters and peak size if DEQUE_STATS is defined (see deque_stats).
+     * Every slot of every allocated chunk is live, dead at the front, or
+     * dead at the back.
+     */
+    deque_stats stats () const {
+      deque_stats s = deque_stats();
+      s.chunks         = _c_last - _c_first;
+      s.table_capacity = _table_size;
+      s.live_slots     = size();
+      if (_b._node) {
+        const size_type front = _b._node - (_table_p + _c_first);
+        const size_type back  = (_table_p + _c_last) - (_e._node + 1);
+        s.spare_chunks = front + back;
+        s.dead_front   = front * chunk_size + (_b._cur - _b._first);
+        s.dead_back    = (back + 1) * chunk_size - (_e._cur - _e._first);
+      }
+      s.bytes = s.chunks * chunk_slots * sizeof(value_type) +
+                (_table_p ? _table_size + 1 : 0) * sizeof(T*);
+#ifdef DEQUE_STATS
+      s.table_reallocations = _counters.table_reallocations;
+      s.table_recenters     = _counters.table_recenters;
+      s.chunk_allocations   = _counters.chunk_allocations;
+      s.chunk_deallocations = _counters.chunk_deallocations;
+      s.peak_size           = _counters.peak_size;
+#endif
+      return s;
+    }
+
+    // ---
+    // sum
+    // ---
+
+    /**
+     * Add up the elements, starting from value_type(), a chunk at a time
+     * with SIMD kernels for arithmetic types (see deque_scan).
+     */
+    value_type sum () const {
+      value_type s = value_type();
+      for_segments(0, size(), [&s] (const_pointer b, const_pointer e) {
+          s = s + deque_scan<deque_simd_sum>(b, e);});
+      return s;
+    }
+
+    // ----
+    // swap
+    // ----
+
+    /**
+     * Exchanges the contents of this deque with those of other. 
+     * Does not invoke any move, copy, or swap operations on individual
+     * elements, except on those in an inline chunk.
+     */
+    void swap (my_deque& that) {
+      if (!deque_inline_policy<C>::value && (_chunk_a == that._chunk_a)) {
+         std::swap(_b, that._b);
+         std::swap(_e, that._e);
+        
+         std::swap(_c_first, that._c_first);
+         std::swap(_c_last, that._c_last);
+         std::swap(_max_spare, that._max_spare);
+         std::swap(_table_size, that._table_size);
+         DEQUE_STAT(std::swap(_counters, that._counters));
+         const bool shared = shared_state::shared();
+         shared_state::shared(that.shared_state::shared());
+         that.shared_state::shared(shared);
+
+         T** p1 = _table_p;
+         T** p2 = that._table_p;
+         std::swap(_table_p, that._table_p);
+         assert(_table_p == p2);
+         assert(that._table_p == p1);
+      }
+      else {
+        my_deque x(std::move(*this));
+        *this = std::move(that);
+        that = std::move(x);
+      }
+      assert(valid());
+  }
+
+#ifdef DEQUE_POSIX
+    // --------------
+    // write_snapshot
+    // --------------
+
+    /**
+     * Write a snapshot of this deque to fd: a deque_snapshot_header, then
+     * the elements straight out of the chunks, a batch of chunks per
+     * writev. read_snapshot and my_mapped_deque read it back.
+     * @throw std::system_error on an I/O error
+     */
+    void write_snapshot (int fd) const {
+      static_assert(std::is_trivially_copyable<value_type>::value,
+                    "write_snapshot needs a trivially copyable T");
+      deque_snapshot_header h = deque_snapshot_make(sizeof(value_type), size());
+      iovec v[deque_iov_max];
+      int   n = 0;
+      v[n++] = iovec{&h, sizeof(h)};
+      for_segments(0, size(), [fd, &v, &n] (const_pointer b, const_pointer e) {
+          if (n == deque_iov_max) {
+            deque_transfer(fd, v, n, true);
+            n = 0;}
+          v[n++] = iovec{const_cast<value_type*>(b), (e - b) * sizeof(value_type)};});
+      deque_transfer(fd, v, n, true);
+    }
+
+  private:
+    // ------
+    // gather
+    // ------
+
+    /**
+     * Describe the next m elements from i, a chunk per buffer, in at most
+     * deque_iov_max buffers at v, and move i and m past the ones described.
+     * @return The number of buffers used
+     */
+    static int gather (iterator& i, size_type& m, iovec* v) {
+      int n = 0;
+      for (; m && (n != deque_iov_max); ++n) {
+        const size_type k = std::min<size_type>(m, i._last - i._cur);
+        v[n] = iovec{i._cur, k * sizeof(value_type)};
+        i += k;
+        m -= k;}
+      return n;
+    }
+
+    // -------------
+    // transfer_once
+    // -------------
+
+    /**
+     * One readv or writev of the n buffers at v, retried after signals.
+     * @return The number of bytes moved, or -1 if fd is non-blocking and
+     *         not ready
+     * @throw std::system_error on any other I/O error
+     */
+    static ssize_t transfer_once (int fd, const iovec* v, int n, bool out) {
+      for (;;) {
+        const ssize_t r = out ? ::writev(fd, v, n) : ::readv(fd, v, n);
+        if (r >= 0)
+          return r;
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+          return -1;
+        if (errno != EINTR)
+          throw std::system_error(errno, std::generic_category(), out ? "writev" : "readv");}
+    }
+#endif
+};
+
+template <typename T, typename A, typename C>
+constexpr typename my_deque<T, A, C>::size_type my_deque<T, A, C>::chunk_size;
+
+template <typename T, typename A, typename C>
+constexpr typename my_deque<T, A, C>::size_type my_deque<T, A, C>::chunk_shift;
+
+template <typename T, typename A, typename C>
+constexpr typename my_deque<T, A, C>::size_type my_deque<T, A, C>::chunk_mask;
+
+template <typename T, typename A, typename C>
+constexpr typename my_deque<T, A, C>::size_type my_deque<T, A, C>::chunk_slots;
+
+template <typename T, typename A, typename C>
+constexpr typename my_deque<T, A, C>::size_type my_deque<T, A, C>::min_table_size;
+
+template <typename T, typename A, typename C>
+constexpr typename my_deque<T, A, C>::size_type my_deque<T, A, C>::default_max_spare;
+
+#ifdef DEQUE_POSIX
+// ---------------
+// my_mapped_deque
+// ---------------
+
+/**
+ * A read-only deque over a snapshot file written by
+ * my_deque::write_snapshot, mapped into memory rather than read: opening
+ * one costs a system call or two whatever the size, and pages come in
+ * from the page cache as they're touched. The snapshot holds the elements
+ * back to back, so the iterators are plain pointers into the mapping.
+ */
+template <typename T>
+class my_mapped_deque {
+  static_assert(std::is_trivially_copyable<T>::value, "my_mapped_deque needs a trivially copyable T");
+  static_assert(alignof(T) <= sizeof(deque_snapshot_header), "my_mapped_deque can't align T");
+
+  public:
+    // --------
+    // typedefs
+    // --------
+
+    typedef T              value_type;
+    typedef std::size_t    size_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const T*       const_pointer;
+    typedef const T&       const_reference;
+    typedef const_pointer  const_iterator;
+    typedef const_iterator iterator;
+
+  private:
+    void*         _map;   //! The mapping, or NULL when moved from
+    std::size_t   _bytes; //! Length of the mapping
+    const_pointer _p;     //! First element
+    size_type     _size;  //! Number of elements
+
+    void unmap () {
+      if (_map)
+        ::munmap(_map, _bytes);
+      _map = NULL;}
+
+  public:
+    // ------------
+    // constructors
+    // ------------
+
+    /**
+     * Map the snapshot in the file at path.
+     * @throw std::runtime_error if it isn't a snapshot of elements of this
+     *        size, std::system_error if it can't be opened or mapped
+     */
+    explicit my_mapped_deque (const char* path) :
+      _map(NULL),
+      _bytes(0),
+      _p(NULL),
+      _size(0) {
+      const int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+      if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), path);
+      struct stat st;
+      if (::fstat(fd, &st) != 0) {
+        const int e = errno;
+        ::close(fd);
+        throw std::system_error(e, std::generic_category(), path);}
+      _bytes = st.st_size;
+      if (_bytes < sizeof(deque_snapshot_header)) {
+        ::close(fd);
+        throw std::runtime_error("deque snapshot: truncated");}
+      _map = ::mmap(NULL, _bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+      const int e = errno;
+      ::close(fd);
+      if (_map == MAP_FAILED) {
+        _map = NULL;
+        throw std::system_error(e, std::generic_category(), "mmap");}
+      try {
+        const deque_snapshot_header& h = *static_cast<const deque_snapshot_header*>(_map);
+        deque_snapshot_check(h, sizeof(T));
+        if (h.size > (_bytes - sizeof(h)) / sizeof(T))
+          throw std::runtime_error("deque snapshot: truncated");
+        _p    = reinterpret_cast<const_pointer>(&h + 1);
+        _size = h.size;}
+      catch (...) {
+        unmap();
+        throw;}}
+
+    my_mapped_deque (my_mapped_deque&& that) noexcept :
+      _map(that._map),
+      _bytes(that._bytes),
+      _p(that._p),
+      _size(that._size) {
+      that._map  = NULL;
+      that._p    = NULL;
+      that._size = 0;}
+
+    my_mapped_deque (const my_mapped_deque&) = delete;
+
+    ~my_mapped_deque () {
+      unmap();}
+
+    // ----------
+    // operator =
+    // ----------
+
+    my_mapped_deque& operator = (my_mapped_deque&& rhs) {
+      std::swap(_map,   rhs._map);
+      std::swap(_bytes, rhs._bytes);
+      std::swap(_p,     rhs._p);
+      std::swap(_size,  rhs._size);
+      return *this;}
+
+    my_mapped_deque& operator = (const my_mapped_deque&) = delete;
+
+    // -----------
+    // operator []
+    // -----------
+
+    const_reference operator [] (size_type i) const {
+      assert(i < _size);
+      return _p[i];}
+
+    // --
+    // at
+    // --
+
+    /**
+     * @throw std::out_of_range if i is not less than size()
+     */
+    const_reference at (size_type i) const {
+      if (i >= _size)
+        throw std::out_of_range("my_mapped_deque::at");
+      return _p[i];}
+
+    // -----------
+    // back, front
+    // -----------
+
+    const_reference back () const {
+      assert(_size);
+      return _p[_size - 1];}
+
+    const_reference front () const {
+      assert(_size);
+      return *_p;}
+
+    // ----------
+    // begin, end
+    // ----------
+
+    const_iterator begin () const {
+      return _p;}
+
+    const_iterator end () const {
+      return _p + _size;}
+
+    // -----------
+    // empty, size
+    // -----------
+
+    bool empty () const {
+      return !_size;}
+
+    size_type size () const {
+      return _size;}};
+#endif
+
+#ifdef DEQUE_POSIX
+// --------------
+// my_spill_deque
+// --------------
+
+/**
+ * A deque for queues that can back up far beyond memory. Elements live in
+ * chunks like my_deque's, but once more than a resident budget of chunks
+ * are in memory, chunks from the middle of the table, which neither end
+ * will reach for a while, are written out to an unlinked temporary file
+ * and freed. The hot chunks at each end, the one being pushed or popped
+ * plus read_ahead more, are always resident, so pushes and pops run at
+ * full speed and only the cold middle pays for I/O. As pops bring spilled
+ * chunks into the hot window they're read back, and the kernel is asked
+ * to start reading the read_ahead chunks after those.
+ *
+ * Spilled chunks are written byte for byte, so T must be trivially
+ * copyable. The chunk table is itself a my_deque.
+ */
+template < typename T,
+           typename A = std::allocator<T>,
+           typename C = deque_chunk_bytes<T> >
+class my_spill_deque {
+  static_assert(std::is_trivially_copyable<T>::value, "my_spill_deque needs a trivially copyable T");
+
+  public:
+    // --------
+    // typedefs
+    // --------
+
+    typedef A                                        allocator_type;
+    typedef std::allocator_traits<A>                 allocator_traits;
+    typedef typename allocator_traits::value_type    value_type;
+
+    typedef typename allocator_traits::size_type       size_type;
+    typedef typename allocator_traits::difference_type difference_type;
+
+    typedef typename allocator_traits::pointer       pointer;
+    typedef value_type&                              reference;
+    typedef const value_type&                        const_reference;
+
+    typedef C                                        chunk_policy;
+
+    //! Number of elements per chunk, always a power of two
+    static constexpr size_type chunk_size = C::value;
+
+    //! Default for the read_ahead constructor argument
+    static constexpr size_type default_read_ahead = 2;
+
+  private:
+    //! A chunk table entry: a resident chunk, or where a spilled one is
+    struct node {
+      pointer _p;     //! The chunk, or NULL if it's spilled
+      off_t   _slot;  //! The chunk's slot in the spill file, if spilled
+    };
+
+    // ----
+    // data
+    // ----
+
+    allocator_type   _a;
+    my_deque<node>   _t;           //! The chunks, front to back
+    size_type        _first;       //! Index of the first element in _t.front()
+    size_type        _last;        //! One past the last element in _t.back()
+    size_type        _size;
+    size_type        _resident;    //! Chunks in memory
+    size_type        _budget;      //! Most chunks kept in memory
+    size_type        _hot;         //! Chunks at each end always in memory
+    std::string      _dir;         //! Where the spill file goes
+    int              _fd;          //! The spill file, or -1 until the first spill
+    off_t            _slots;       //! Slots in the spill file
+    std::vector<off_t> _free;      //! Slots in the spill file not in use
+
+    static constexpr std::size_t chunk_bytes = chunk_size * sizeof(value_type);
+
+    // -----
+    // valid
+    // -----
+
+    bool valid () const {
+      return (_resident <= _t.size()) &&
+             (_t.empty() ? !_size : (_first < _last) || (_t.size() > 1)) &&
+             (_first <= chunk_size) && (_last <= chunk_size);
+    }
+
+    // -----------
+    // spill, load
+    // -----------
+
+    /**
+     * Write resident chunk i out to the spill file and free it.
+     */
+    void spill (size_type i) {
+      node& x = _t[i];
+      assert(x._p);
+      if (_fd < 0) {
+        std::string path = _dir + "/my_spill_dequeXXXXXX";
+        _fd = ::mkstemp(&path[0]);
+        if (_fd < 0)
+          throw std::system_error(errno, std::generic_category(), path);
+        ::unlink(path.c_str());}
+      off_t slot;
+      if (_free.empty())
+        slot = _slots++;
+      else {
+        slot = _free.back();
+        _free.pop_back();}
+      try {
+        deque_transfer_at(_fd, x._p, chunk_bytes, slot * off_t(chunk_bytes), true);
+      }
+      catch (...) {
+        _free.push_back(slot);
+        throw;
+      }
+      allocator_traits::deallocate(_a, x._p, chunk_size);
+      x._p    = pointer();
+      x._slot = slot;
+      --_resident;
+    }
+
+    /**
+     * Read spilled chunk i back into memory.
+     */
+    void load (size_type i) {
+      node& x = _t[i];
+      assert(!x._p);
+      const pointer p = allocator_traits::allocate(_a, chunk_size);
+      try {
+        deque_transfer_at(_fd, p, chunk_bytes, x._slot * off_t(chunk_bytes), false);
+      }
+      catch (...) {
+        allocator_traits::deallocate(_a, p, chunk_size);
+        throw;
+      }
+      _free.push_back(x._slot);
+      x._p = p;
+      ++_resident;
+    }
+
+    // -------
+    // balance
+    // -------
+
+    /**
+     * Spill middle chunks until no more than the budget are resident,
+     * starting next to the hot chunks at the back if from_back, else at
+     * the front, and working inwards: those are the ones pops at the
+     * other end will need last.
+     */
+    void balance (bool from_back) {
+      if (_t.size() <= 2 * _hot)
+        return;
+      const size_type lo = _hot;
+      const size_type hi = _t.size() - _hot;
+      for (size_type k = 0; (_resident > _budget) && (k != hi - lo); ++k) {
+        const size_type i = from_back ? hi - 1 - k : lo + k;
+        if (_t[i]._p)
+          spill(i);}
+    }
+
+    /**
+     * Bring the hot chunks at the front, or at the back, back into memory,
+     * and have the kernel start reading the read-ahead chunks after them.
+     */
+    void warm (bool front) {
+      const size_type n = _t.size();
+      for (size_type k = 0; (k != _hot) && (k != n); ++k) {
+        const size_type i = front ? k : n - 1 - k;
+        if (!_t[i]._p)
+          load(i);}
+#ifdef POSIX_FADV_WILLNEED
+      for (size_type k = _hot; (k < 2 * _hot) && (k < n); ++k) {
+        const node& x = _t[front ? k : n - 1 - k];
+        if (!x._p)
+          ::posix_fadvise(_fd, x._slot * off_t(chunk_bytes), chunk_bytes, POSIX_FADV_WILLNEED);}
+#endif
+    }
+
+    // ---------------------
+    // add_chunk, drop_chunk
+    // ---------------------
+
+    void add_chunk (bool back) {
+      const node x = {allocator_traits::allocate(_a, chunk_size), 0};
+      try {
+        if (back)
+          _t.push_back(x);
+        else
+          _t.push_front(x);
+      }
+      catch (...) {
+        allocator_traits::deallocate(_a, x._p, chunk_size);
+        throw;
+      }
+      ++_resident;
+    }
+
+    void drop_chunk (bool back) {
+      node& x = back ? _t.back() : _t.front();
+      assert(x._p);
+      allocator_traits::deallocate(_a, x._p, chunk_size);
+      --_resident;
+      if (back)
+        _t.pop_back();
+      else
+        _t.pop_front();
+    }
+
+  public:
+    // ------------
+    // constructors
+    // ------------
+
+    /**
+     * An empty deque that keeps at most about resident_bytes of chunks in
+     * memory, but never fewer than the hot chunks at both ends.
+     * @param resident_bytes The resident budget
+     * @param dir            The directory for the spill file
+     * @param read_ahead     Chunks read ahead of pops at either end
+     */
+    explicit my_spill_deque (size_type resident_bytes,
+                             const std::string& dir = "/tmp",
+                             size_type read_ahead = default_read_ahead,
+                             const allocator_type& a = allocator_type()) :
+      _a(a),
+      _t(),
+      _first(0),
+      _last(0),
+      _size(0),
+      _resident(0),
+      _budget(std::max<size_type>(resident_bytes / chunk_bytes, 2 * (read_ahead + 1))),
+      _hot(read_ahead + 1),
+      _dir(dir),
+      _fd(-1),
+      _slots(0),
+      _free()
+    {}
+
+    my_spill_deque (const my_spill_deque&) = delete;
+    my_spill_deque& operator = (const my_spill_deque&) = delete;
+
+    // ----------
+    // destructor
+    // ----------
+
+    ~my_spill_deque () {
+      for (node& x : _t)
+        if (x._p)
+          allocator_traits::deallocate(_a, x._p, chunk_size);
+      if (_fd >= 0)
+        ::close(_fd);
+    }
+
+    // -----------
+    // back, front
+    // -----------
+
+    reference back () {
+      assert(!empty());
+      return _t.back()._p[_last - 1];
+    }
+
+    const_reference back () const {
+      return const_cast<my_spill_deque*>(this)->back();
+    }
+
+    reference front () {
+      assert(!empty());
+      return _t.front()._p[_first];
+    }
+
+    const_reference front () const {
+      return const_cast<my_spill_deque*>(this)->front();
+    }
+
+    // -----------
+    // empty, size
+    // -----------
+
+    bool empty () const {
+      return !_size;
+    }
+
+    size_type size () const {
+      return _size;
+    }
+
+    // ---
+    // pop
+    // ---
+
+    /**
+     * Remove the first element, reading chunks back in as they come
+     * within read_ahead chunks of the front.
+     * @throw std::system_error if the spill file can't be read
+     */
+    void pop_front () {
+      assert(!empty());
+      ++_first;
+      --_size;
+      if ((_first == chunk_size) || !_size) {
+        drop_chunk(false);
+        _first = 0;
+        if (_t.empty())
+          _last = 0;
+        else {
+          warm(true);
+          balance(true);}}
+      assert(valid());
+    }
+
+    /**
+     * Remove the last element, reading chunks back in as they come within
+     * read_ahead chunks of the back.
+     * @throw std::system_error if the spill file can't be read
+     */
+    void pop_back () {
+      assert(!empty());
+      --_last;
+      --_size;
+      if (!_last || !_size) {
+        drop_chunk(true);
+        _last = chunk_size;
+        if (_t.empty())
+          _first = _last = 0;
+        else {
+          warm(false);
+          balance(false);}}
+      assert(valid());
+    }
+
+    // ----
+    // push
+    // ----
+
+    /**
+     * Append v, spilling a middle chunk if a new chunk takes this deque
+     * over its resident budget.
+     * @throw std::system_error if the spill file can't be written
+     */
+    void push_back (const_reference v) {
+      const bool grow = _t.empty() || (_last == chunk_size);
+      if (grow) {
+        add_chunk(true);
+        if (_t.size() == 1)
+          _first = 0;
+        _last = 0;}
+      allocator_traits::construct(_a, _t.back()._p + _last, v);
+      ++_last;
+      ++_size;
+      if (grow)
+        balance(true);
+      assert(valid());
+    }
+
+    /**
+     * Prepend v, spilling a middle chunk if a new chunk takes this deque
+     * over its resident budget.
+     * @throw std::system_error if the spill file can't be written
+     */
+    void push_front (const_reference v) {
+      const bool grow = _t.empty() || !_first;
+      if (grow) {
+        add_chunk(false);
+        if (_t.size() == 1)
+          _last = chunk_size;
+        _first = chunk_size;}
+      allocator_traits::construct(_a, _t.front()._p + _first - 1, v);
+      --_first;
+      ++_size;
+      if (grow)
+        balance(false);
+      assert(valid());
+    }
+
+    // -------------------------------
+    // resident_chunks, spilled_chunks
+    // -------------------------------
+
+    /**
+     * Chunks in memory.
+     */
+    size_type resident_chunks () const {
+      return _resident;
+    }
+
+    /**
+     * Chunks in the spill file.
+     */
+    size_type spilled_chunks () const {
+      return _t.size() - _resident;
+    }
+};
+
+template <typename T, typename A, typename C>
+constexpr typename my_spill_deque<T, A, C>::size_type my_spill_deque<T, A, C>::chunk_size;
+
+template <typename T, typename A, typename C>
+constexpr typename my_spill_deque<T, A, C>::size_type my_spill_deque<T, A, C>::default_read_ahead;
+
+template <typename T, typename A, typename C>
+constexpr std::size_t my_spill_deque<T, A, C>::chunk_bytes;
+#endif
+
+// ----------------
+// deque_ring_slots
+// ----------------
+
+/**
+ * The slots of a my_ring_deque with a compile-time capacity of N; empty
+ * when N is 0 and the capacity is chosen at construction.
+ */
+template <typename T, std::size_t N>
+struct deque_ring_slots {
+  static_assert(!(N & (N - 1)), "ring capacity must be a power of two");
+
+  typename std::aligned_storage<sizeof(T), alignof(T)>::type _s[N];
+
+  T* data () {
+    return reinterpret_cast<T*>(_s);}};
+
+template <typename T>
+struct deque_ring_slots<T, 0> {
+  T* data () {
+    return NULL;}};
+
+// -------------
+// my_ring_deque
+// -------------
+
+/**
+ * A bounded deque that never allocates after construction, for windows
+ * over the most recent elements. The capacity is N if N isn't 0, with the
+ * slots inside the object, or else the one given to the constructor
+ * rounded up to a power of two, allocated once. Either way positions wrap
+ * around with a mask, so a push or a pop is a handful of instructions.
+ * When full, try_push_back and try_push_front refuse and
+ * push_back_overwrite replaces the oldest element. Otherwise it looks
+ * like my_deque: operator[], at, front, back, random access iterators,
+ * pops at both ends. A ring with N == 0 that has been moved from has no
+ * capacity left until it's assigned to.
+ */
+template < typename T,
+           typename A = std::allocator<T>,
+           std::size_t N = 0 >
+class my_ring_deque {
+  public:
+    // --------
+    // typedefs
+    // --------
+
+    typedef A                                        allocator_type;
+    typedef std::allocator_traits<A>                 allocator_traits;
+    typedef typename allocator_traits::value_type    value_type;
+
+    typedef typename allocator_traits::size_type       size_type;
+    typedef typename allocator_traits::difference_type difference_type;
+
+    typedef value_type*                              pointer;
+    typedef const value_type*                        const_pointer;
+    typedef value_type&                              reference;
+    typedef const value_type&                        const_reference;
+
+    // --------------
+    // basic_iterator
+    // --------------
+
+    /**
+     * A random access iterator: the ring and an unwrapped position in it.
+     * Q is value_type for iterator and const value_type for
+     * const_iterator.
+     */
+    template <typename Q>
+    class basic_iterator {
+      friend class my_ring_deque;
+
+      template <typename R>
+      friend class basic_iterator;
+
+      public:
+        typedef std::random_access_iterator_tag iterator_category;
+        typedef typename std::remove_const<Q>::type value_type;
+        typedef typename my_ring_deque::difference_type difference_type;
+        typedef Q*                              pointer;
+        typedef Q&                              reference;
+
+      private:
+        pointer   _p;
+        size_type _mask;
+        size_type _i;
+
+        basic_iterator (pointer p, size_type mask, size_type i) :
+          _p(p), _mask(mask), _i(i) {}
+
+      public:
+        basic_iterator () :
+          _p(NULL), _mask(0), _i(0) {}
+
+        template <typename R,
+                  typename = typename std::enable_if<std::is_convertible<R*, Q*>::value>::type>
+        basic_iterator (const basic_iterator<R>& that) :
+          _p(that._p), _mask(that._mask), _i(that._i) {}
+
+        friend bool operator == (const basic_iterator& lhs, const basic_iterator& rhs) {
+          return lhs._i == rhs._i;}
+
+        friend bool operator != (const basic_iterator& lhs, const basic_iterator& rhs) {
+          return lhs._i != rhs._i;}
+
+        friend bool operator < (const basic_iterator& lhs, const basic_iterator& rhs) {
+          return difference_type(lhs._i - rhs._i) < 0;}
+
+        friend bool operator > (const basic_iterator& lhs, const basic_iterator& rhs) {
+          return rhs < lhs;}
+
+        friend bool operator <= (const basic_iterator& lhs, const basic_iterator& rhs) {
+          return !(rhs < lhs);}
+
+        friend bool operator >= (const basic_iterator& lhs, const basic_iterator& rhs) {
+          return !(lhs < rhs);}
+
+        friend difference_type operator - (const basic_iterator& lhs, const basic_iterator& rhs) {
+          return difference_type(lhs._i - rhs._i);}
+
+        friend basic_iterator operator + (basic_iterator lhs, difference_type n) {
+          return lhs += n;}
+
+        friend basic_iterator operator + (difference_type n, basic_iterator rhs) {
+          return rhs += n;}
+
+        friend basic_iterator operator - (basic_iterator lhs, difference_type n) {
+          return lhs -= n;}
+
+        reference operator * () const {
+          return _p[_i & _mask];}
+
+        pointer operator -> () const {
+          return &**this;}
+
+        reference operator [] (difference_type n) const {
+          return _p[(_i + n) & _mask];}
+
+        basic_iterator& operator ++ () {
+          ++_i;
+          return *this;}
+
+        basic_iterator operator ++ (int) {
+          basic_iterator x = *this;
+          ++_i;
+          return x;}
+
+        basic_iterator& operator -- () {
+          --_i;
+          return *this;}
+
+        basic_iterator operator -- (int) {
+          basic_iterator x = *this;
+          --_i;
+          return x;}
+
+        basic_iterator& operator += (difference_type n) {
+          _i += n;
+          return *this;}
+
+        basic_iterator& operator -= (difference_type n) {
+          _i -= n;
+          return *this;}};
+
+    typedef basic_iterator<value_type>       iterator;
+    typedef basic_iterator<const value_type> const_iterator;
+
+  private:
+    // ----
+    // data
+    // ----
+
+    allocator_type            _a;
+    deque_ring_slots<T, N>    _slots;
+    pointer                   _p;     //! The slots
+    size_type                 _mask;  //! capacity() - 1
+    size_type                 _head;  //! Unwrapped position of the first element
+    size_type                 _size;
+
+    static size_type round_up (size_type n) {
+      size_type c = 1;
+      while (c < n)
+        c *= 2;
+      return c;}
+
+    pointer slot (size_type i) const {
+      return _p + (i & (N ? N - 1 : _mask));}
+
+    void release () {
+      clear();
+      if (!N && _p)
+        allocator_traits::deallocate(_a, _p, _mask + 1);
+      _p = NULL;}
+
+    /**
+     * Take the elements of that, which is left empty: its slots if
+     * they're allocated, otherwise one element at a time.
+     */
+    void take (my_ring_deque& that) {
+      if (!N) {
+        _p    = that._p;
+        _mask = that._mask;
+        _head = that._head;
+        _size = that._size;
+        that._p = NULL;
+        that._size = 0;
+        return;}
+      for (size_type i = 0; i != that._size; ++i)
+        allocator_traits::construct(_a, slot(_head + i), std::move(that[i]));
+      _size = that._size;
+      that.clear();}
+
+  public:
+    // ------------
+    // constructors
+    // ------------
+
+    /**
+     * An empty ring of capacity N, or of capacity c rounded up to a power
+     * of two if N is 0. This is the only allocation it ever makes.
+     */
+    explicit my_ring_deque (size_type c = N, const allocator_type& a = allocator_type()) :
+      _a(a),
+      _slots(),
+      _p(N ? _slots.data() : allocator_traits::allocate(_a, round_up(c))),
+      _mask((N ? N : round_up(c)) - 1),
+      _head(0),
+      _size(0)
+    {}
+
+    my_ring_deque (const my_ring_deque& that) :
+      my_ring_deque(that.capacity(),
+                    allocator_traits::select_on_container_copy_construction(that._a))
+    {
+      for (const_reference v : that)
+        allocator_traits::construct(_a, slot(_head + _size++), v);
+    }
+
+    my_ring_deque (my_ring_deque&& that) :
+      _a(that._a),
+      _slots(),
+      _p(_slots.data()),
+      _mask(N ? N - 1 : 0),
+      _head(0),
+      _size(0)
+    {
+      take(that);
+    }
+
+    ~my_ring_deque () {
+      release();
+    }
+
+    // ----------
+    // operator =
+    // ----------
+
+    my_ring_deque& operator = (const my_ring_deque& rhs) {
+      if (this != &rhs) {
+        my_ring_deque x(rhs);
+        *this = std::move(x);
+      }
+      return *this;
+    }
+
+    /**
+     * Take the elements of rhs. Allocated slots are taken over if the
+     * allocators are equal; otherwise the elements are moved one by one
+     * into slots of rhs's capacity.
+     */
+    my_ring_deque& operator = (my_ring_deque&& rhs) {
+      if (this == &rhs)
+        return *this;
+      if (N || (_a == rhs._a)) {
+        release();
+        _p    = N ? _slots.data() : NULL;
+        _head = 0;
+        take(rhs);
+      }
+      else {
+        release();
+        _mask = rhs._mask;
+        _head = 0;
+        _p    = allocator_traits::allocate(_a, _mask + 1);
+        for (; _size != rhs._size; ++_size)
+          allocator_traits::construct(_a, slot(_size), std::move(rhs[_size]));
+        rhs.clear();
+      }
+      return *this;
+    }
+
+    // -----------
+    // operator []
+    // -----------
+
+    reference operator [] (size_type i) {
+      assert(i < _size);
+      return *slot(_head + i);
+    }
+
+    const_reference operator [] (size_type i) const {
+      return const_cast<my_ring_deque&>(*this)[i];
+    }
+
+    // --
+    // at
+    // --
+
+    /**
+     * @throw std::out_of_range if i is not less than size()
+     */
+    reference at (size_type i) {
+      if (i >= _size)
+        throw std::out_of_range("my_ring_deque::at");
+      return (*this)[i];
+    }
+
+    const_reference at (size_type i) const {
+      return const_cast<my_ring_deque&>(*this).at(i);
+    }
+
+    // -----------
+    // back, front
+    // -----------
+
+    reference back () {
+      assert(_size);
+      return *slot(_head + _size - 1);
+    }
+
+    const_reference back () const {
+      return const_cast<my_ring_deque&>(*this).back();
+    }
+
+    reference front () {
+      assert(_size);
+      return *slot(_head);
+    }
+
+    const_reference front () const {
+      return const_cast<my_ring_deque&>(*this).front();
+    }
+
+    // ----------
+    // begin, end
+    // ----------
+
+    iterator begin () {
+      return iterator(_p, _mask, _head);
+    }
+
+    const_iterator begin () const {
+      return const_iterator(_p, _mask, _head);
+    }
+
+    iterator end () {
+      return iterator(_p, _mask, _head + _size);
+    }
+
+    const_iterator end () const {
+      return const_iterator(_p, _mask, _head + _size);
+    }
+
+    // --------
+    // capacity
+    // --------
+
+    size_type capacity () const {
+      return N ? N : _p ? _mask + 1 : 0;
+    }
+
+    // -----
+    // clear
+    // -----
+
+    void clear () {
+      while (_size)
+        pop_back();
+    }
+
+    // -----------------
+    // empty, full, size
+    // -----------------
+
+    bool empty () const {
+      return !_size;
+    }
+
+    bool full () const {
+      return _size == capacity();
+    }
+
+    size_type size () const {
+      return _size;
+    }
+
+    // -------------
+    // get_allocator
+    // -------------
+
+    allocator_type get_allocator () const {
+      return _a;
+    }
+
+    // ---
+    // pop
+    // ---
+
+    void pop_back () {
+      assert(_size);
+      --_size;
+      allocator_traits::destroy(_a, slot(_head + _size));
+    }
+
+    void pop_front () {
+      assert(_size);
+      allocator_traits::destroy(_a, slot(_head));
+      ++_head;
+      --_size;
+    }
+
+    // -------------------
+    // push_back_overwrite
+    // -------------------
+
+    /**
+     * Append v. If the ring is full, v is assigned over the oldest
+     * element, which the front then moves past.
+     */
+    template <typename U>
+    void push_back_overwrite (U&& v) {
+      assert(capacity());
+      if (full()) {
+        *slot(_head) = std::forward<U>(v);
+        ++_head;
+      }
+      else
+        allocator_traits::construct(_a, slot(_head + _size++), std::forward<U>(v));
+    }
+
+    // --------
+    // try_push
+    // --------
+
+    /**
+     * Construct an element from args at the back, unless the ring is full.
+     * @return Whether there was room
+     */
+    template <typename... Args>
+    bool try_emplace_back (Args&&... args) {
+      if (full())
+        return false;
+      allocator_traits::construct(_a, slot(_head + _size), std::forward<Args>(args)...);
+      ++_size;
+      return true;
+    }
+
+    /**
+     * Construct an element from args at the front, unless the ring is full.
+     * @return Whether there was room
+     */
+    template <typename... Args>
+    bool try_emplace_front (Args&&... args) {
+      if (full())
+        return false;
+      allocator_traits::construct(_a, slot(_head - 1), std::forward<Args>(args)...);
+      --_head;
+      ++_size;
+      return true;
+    }
+
+    bool try_push_back (const_reference v) {
+      return try_emplace_back(v);
+    }
+
+    bool try_push_back (value_type&& v) {
+      return try_emplace_back(std::move(v));
+    }
+
+    bool try_push_front (const_reference v) {
+      return try_emplace_front(v);
+    }
+
+    bool try_push_front (value_type&& v) {
+      return try_emplace_front(std::move(v));
+    }
 };
 
+// -------------
+// my_spsc_deque
+// -------------
+
+/**
+ * A lock-free queue for exactly one producer thread and one consumer
+ * thread, laid out like my_deque: elements live in power of two chunks
+ * from the same chunk policy, constructed only while they are queued.
+ * A chunk table can't be regrown under a concurrent reader without a
+ * lock, so chunks are linked instead: the producer appends into the tail
+ * chunk and links a new one when it fills, the consumer drains the head
+ * chunk and follows the link. The only synchronization is a release
+ * store / acquire load on each chunk's published count and next link.
+ * Drained chunks go back to the producer through a small ring of spares,
+ * like the spare chunks my_deque rotates from one end to the other.
+ */
+template < typename T,
+           typename A = std::allocator<T>,
+           typename C = deque_chunk_bytes<T> >
+class my_spsc_deque {
+  public:
+    // --------
+    // typedefs
+    // --------
+
+    typedef A                                        allocator_type;
+    typedef std::allocator_traits<A>                 allocator_traits;
+    typedef typename allocator_traits::value_type    value_type;
+
+    typedef typename allocator_traits::size_type       size_type;
+    typedef typename allocator_traits::difference_type difference_type;
+
+    typedef value_type&                              reference;
+    typedef const value_type&                        const_reference;
+
+    typedef C                                        chunk_policy;
+
+    //! Number of elements per chunk, always a power of two
+    static constexpr size_type chunk_size = C::value;
+
+    //! Most drained chunks kept for the producer to reuse
+    static constexpr size_type max_spare = 8;
+
+  private:
+    // -----
+    // chunk
+    // -----
+
+    struct chunk {
+      //! Slots [0, _w) hold elements published by the producer
+      std::atomic<size_type> _w;
+      //! The chunk the producer moved on to once this one filled
+      std::atomic<chunk*>    _next;
+      T*                     _slots;};
+
+    typedef typename allocator_traits::template rebind_alloc<chunk>  chunk_allocator;
+    typedef typename allocator_traits::template rebind_traits<chunk> chunk_traits;
+
+    //! Keeps the producer's and the consumer's fields on separate cache lines
+    static constexpr std::size_t cache_line = 64;
+
+    // ----
+    // data
+    // ----
+
+    allocator_type  _slot_a;
+    chunk_allocator _chunk_a;
+
+    // Spares: the consumer writes [_spare_r, _spare_w), the producer takes
+    // from the front. Each side only stores to its own index.
+    chunk*                 _spare[max_spare];
+    std::atomic<size_type> _spare_w;
+    char                   _pad0[cache_line];
+    std::atomic<size_type> _spare_r;
+
+    // Producer side
+    chunk*    _tail;
+    size_type _tail_w;          //! Producer's copy of _tail->_w
+    char      _pad1[cache_line];
+
+    // Consumer side
+    chunk*    _head;
+    size_type _head_r;          //! Next slot to pop in _head
+    size_type _head_w;          //! Last value of _head->_w the consumer saw
+    char      _pad2[cache_line];
+
+  private:
+    // ---------------
+    // chunk lifecycle
+    // ---------------
+
+    chunk* allocate_chunk () {
+      chunk* c = chunk_traits::allocate(_chunk_a, 1);
+      try {
+        c->_slots = allocator_traits::allocate(_slot_a, chunk_size);
+      }
+      catch (...) {
+        chunk_traits::deallocate(_chunk_a, c, 1);
+        throw;
+      }
+      new (&c->_w)    std::atomic<size_type>(0);
+      new (&c->_next) std::atomic<chunk*>(nullptr);
+      return c;
+    }
+
+    void deallocate_chunk (chunk* c) {
+      allocator_traits::deallocate(_slot_a, c->_slots, chunk_size);
+      chunk_traits::deallocate(_chunk_a, c, 1);
+    }
+
+    /**
+     * Producer: reuse a drained chunk if the consumer has returned one.
+     */
+    chunk* acquire_chunk () {
+      const size_type r = _spare_r.load(std::memory_order_relaxed);
+      if (r == _spare_w.load(std::memory_order_acquire))
+        return allocate_chunk();
+      chunk* c = _spare[r % max_spare];
+      _spare_r.store(r + 1, std::memory_order_release);
+      c->_w.store(0, std::memory_order_relaxed);
+      c->_next.store(nullptr, std::memory_order_relaxed);
+      return c;
+    }
+
+    /**
+     * Consumer: hand a drained chunk back to the producer, or give it back
+     * to the allocator if the producer already has enough spares.
+     */
+    void recycle_chunk (chunk* c) {
+      const size_type w = _spare_w.load(std::memory_order_relaxed);
+      if (w - _spare_r.load(std::memory_order_acquire) == max_spare)
+        deallocate_chunk(c);
+      else {
+        _spare[w % max_spare] = c;
+        _spare_w.store(w + 1, std::memory_order_release);
+      }
+    }
+
+  public:
+    // ------------
+    // constructors
+    // ------------
+
+    explicit my_spsc_deque (const allocator_type& a = allocator_type()) :
+        _slot_a(a),
+        _chunk_a(a),
+        _spare_w(0),
+        _spare_r(0),
+        _tail(NULL),
+        _tail_w(0),
+        _head(NULL),
+        _head_r(0),
+        _head_w(0) {
+      _head = _tail = allocate_chunk();}
+
+    my_spsc_deque (const my_spsc_deque&) = delete;
+    my_spsc_deque& operator = (const my_spsc_deque&) = delete;
+
+    // ----------
+    // destructor
+    // ----------
+
+    /**
+     * Destroy whatever is still queued. Neither thread may be using the
+     * queue any more.
+     */
+    ~my_spsc_deque () {
+      chunk* c = _head;
+      size_type r = _head_r;
+      while (c) {
+        const size_type w = c->_w.load(std::memory_order_acquire);
+        for (; r != w; ++r)
+          allocator_traits::destroy(_slot_a, c->_slots + r);
+        chunk* n = c->_next.load(std::memory_order_acquire);
+        deallocate_chunk(c);
+        c = n;
+        r = 0;
+      }
+      for (size_type i = _spare_r; i != _spare_w; ++i)
+        deallocate_chunk(_spare[i % max_spare]);}
+
+    // ------------
+    // emplace_back
+    // ------------
+
+    /**
+     * Producer only: construct an element from args at the back.
+     */
+    template <typename... Args>
+    void emplace_back (Args&&... args) {
+      if (_tail_w == chunk_size) {
+        chunk* c = acquire_chunk();
+        _tail->_next.store(c, std::memory_order_release);
+        _tail   = c;
+        _tail_w = 0;
+      }
+      allocator_traits::construct(_slot_a, _tail->_slots + _tail_w, std::forward<Args>(args)...);
+      _tail->_w.store(++_tail_w, std::memory_order_release);}
+
+    // -----
+    // empty
+    // -----
+
+    /**
+     * Consumer only: whether there is nothing to pop right now.
+     */
+    bool empty () {
+      return !front();}
+
+    // -----
+    // front
+    // -----
+
+    /**
+     * Consumer only: the oldest element, or NULL if there is none yet.
+     * It stays put until the consumer pops it.
+     */
+    value_type* front () {
+      if (_head_r == _head_w) {
+        if (_head_r == chunk_size) {
+          chunk* n = _head->_next.load(std::memory_order_acquire);
+          if (!n)
+            return NULL;
+          recycle_chunk(_head);
+          _head   = n;
+          _head_r = 0;
+        }
+        _head_w = _head->_w.load(std::memory_order_acquire);
+        if (_head_r == _head_w)
+          return NULL;
+      }
+      return _head->_slots + _head_r;}
+
+    // -------------
+    // get_allocator
+    // -------------
+
+    allocator_type get_allocator () const {
+      return _slot_a;}
+
+    // ---------
+    // pop_front
+    // ---------
+
+    /**
+     * Consumer only: remove the oldest element, which must exist (see
+     * front).
+     */
+    void pop_front () {
+      assert(_head_r < _head_w);
+      allocator_traits::destroy(_slot_a, _head->_slots + _head_r);
+      ++_head_r;}
+
+    // ---------
+    // push_back
+    // ---------
+
+    /**
+     * Producer only: append a copy of v.
+     */
+    void push_back (const_reference v) {
+      emplace_back(v);}
+
+    /**
+     * Producer only: move v in at the back.
+     */
+    void push_back (value_type&& v) {
+      emplace_back(std::move(v));}
+
+    // -------------
+    // try_pop_front
+    // -------------
+
+    /**
+     * Consumer only: move the oldest element into v and remove it.
+     * @return false, leaving v alone, if there is nothing to pop
+     */
+    bool try_pop_front (reference v) {
+      value_type* p = front();
+      if (!p)
+        return false;
+      v = std::move(*p);
+      pop_front();
+      return true;}};
+
+template <typename T, typename A, typename C>
+constexpr typename my_spsc_deque<T, A, C>::size_type my_spsc_deque<T, A, C>::chunk_size;
+
+template <typename T, typename A, typename C>
+constexpr typename my_spsc_deque<T, A, C>::size_type my_spsc_deque<T, A, C>::max_spare;
+
+template <typename T, typename A, typename C>
+constexpr std::size_t my_spsc_deque<T, A, C>::cache_line;
+
+// --------------
+// my_steal_deque
+// --------------
+
+/**
+ * A Chase-Lev work-stealing deque: the owning thread pushes and pops at
+ * the back without locking, and any thread may steal from the front.
+ * Storage is a circular chunk table in the style of my_deque: element i
+ * lives in chunk (i >> shift) of the table, modulo its size. Growing
+ * doubles the table and carries the existing chunks over by pointer, so
+ * there is never one huge contiguous ring to copy. Old tables stay around
+ * until destruction, since a thief may still be reading through one.
+ * Elements are read and written as relaxed atomics, so T must be
+ * trivially copyable, and should be small enough for std::atomic<T> to be
+ * lock-free; tasks are normally handed around by pointer anyway.
+ */
+template < typename T,
+           typename A = std::allocator<T>,
+           typename C = deque_chunk_bytes<T> >
+class my_steal_deque {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "my_steal_deque elements must be trivially copyable");
+
+  public:
+    // --------
+    // typedefs
+    // --------
+
+    typedef A                                        allocator_type;
+    typedef std::allocator_traits<A>                 allocator_traits;
+    typedef typename allocator_traits::value_type    value_type;
+
+    typedef typename allocator_traits::size_type       size_type;
+    typedef typename allocator_traits::difference_type difference_type;
+
+    typedef value_type&                              reference;
+    typedef const value_type&                        const_reference;
+
+    typedef C                                        chunk_policy;
+
+    //! Number of elements per chunk, always a power of two
+    static constexpr size_type chunk_size  = C::value;
+    static constexpr size_type chunk_shift = C::shift;
+    static constexpr size_type chunk_mask  = C::mask;
+
+  private:
+    typedef std::atomic<T> slot;
+
+    typedef typename allocator_traits::template rebind_alloc<slot>  slot_allocator;
+    typedef typename allocator_traits::template rebind_alloc<slot*> chunks_allocator;
+
+    // -----
+    // table
+    // -----
+
+    struct table {
+      slot**    _chunks;  //! _size chunks, used circularly
+      size_type _size;    //! Always a power of two
+      table*    _prev;    //! The table this one replaced
+      slot*     _orphan;  //! A chunk of _prev's that this one doesn't use
+
+      slot& operator [] (difference_type i) const {
+        return _chunks[size_type(i >> chunk_shift) & (_size - 1)][i & chunk_mask];}};
+
+    //! Keeps the thieves' index and the owner's index on separate cache lines
+    static constexpr std::size_t cache_line = 64;
+
+    //! Chunks in the first table
+    static constexpr size_type min_table_size = 2;
+
+    // ----
+    // data
+    // ----
+
+    slot_allocator   _slot_a;
+    chunks_allocator _chunks_a;
+
+    //! Elements [_top, _bottom) are in the deque. Thieves advance _top;
+    //! the owner moves _bottom, and resolves a race for the last element
+    //! by advancing _top too.
+    std::atomic<difference_type> _top;
+    char                         _pad0[cache_line];
+    std::atomic<difference_type> _bottom;
+    std::atomic<table*>          _table;
+    char                         _pad1[cache_line];
+
+  private:
+    // ---------------
+    // chunk lifecycle
+    // ---------------
+
+    slot* allocate_chunk () {
+      slot* c = std::allocator_traits<slot_allocator>::allocate(_slot_a, chunk_size);
+      for (size_type i = 0; i != chunk_size; ++i)
+        new (c + i) slot();
+      return c;
+    }
+
+    void deallocate_chunk (slot* c) {
+      std::allocator_traits<slot_allocator>::deallocate(_slot_a, c, chunk_size);
+    }
+
+    table* allocate_table (size_type n) {
+      table* t = new table();
+      try {
+        t->_chunks = std::allocator_traits<chunks_allocator>::allocate(_chunks_a, n);
+      }
+      catch (...) {
+        delete t;
+        throw;
+      }
+      std::fill(t->_chunks, t->_chunks + n, static_cast<slot*>(NULL));
+      t->_size   = n;
+      t->_prev   = NULL;
+      t->_orphan = NULL;
+      return t;
+    }
+
+    void deallocate_table (table* t) {
+      std::allocator_traits<chunks_allocator>::deallocate(_chunks_a, t->_chunks, t->_size);
+      delete t;
+    }
+
+    // ----
+    // grow
+    // ----
+
+    /**
+     * Owner only: replace a full table with one twice the size. Chunks
+     * holding elements [t, b) keep their chunk numbers, which only land
+     * in new slots, so they move over by pointer. If t isn't on a chunk
+     * boundary, the first and last chunk numbers share a chunk in the old
+     * table. Both get fresh copies then, and the shared chunk is never
+     * written again, so a thief still reading the old table sees stable
+     * values.
+     */
+    table* grow (table* a, difference_type t, difference_type b) {
+      table* n = allocate_table(2 * a->_size);
+      const difference_type first = t >> chunk_shift;
+      const difference_type last  = (b - 1) >> chunk_shift;
+      const bool            split = (last - first == difference_type(a->_size));
+      try {
+        for (difference_type k = first; k <= last; ++k) {
+          slot*& c = n->_chunks[size_type(k) & (n->_size - 1)];
+          if (!split || ((k != first) && (k != last)))
+            c = a->_chunks[size_type(k) & (a->_size - 1)];
+          else {
+            c = allocate_chunk();
+            const difference_type i = std::max(t, k << chunk_shift);
+            const difference_type e = std::min(b, (k + 1) << chunk_shift);
+            for (difference_type j = i; j != e; ++j)
+              c[j & chunk_mask].store((*a)[j].load(std::memory_order_relaxed),
+                                      std::memory_order_relaxed);
+          }
+        }
+        for (size_type i = 0; i != n->_size; ++i)
+          if (!n->_chunks[i])
+            n->_chunks[i] = allocate_chunk();
+      }
+      catch (...) {
+        // Give back only the chunks allocated here
+        for (size_type i = 0; i != n->_size; ++i) {
+          slot* c = n->_chunks[i];
+          if (c && (std::find(a->_chunks, a->_chunks + a->_size, c) == a->_chunks + a->_size))
+            deallocate_chunk(c);
+        }
+        deallocate_table(n);
+        throw;
+      }
+      if (split)
+        n->_orphan = a->_chunks[size_type(first) & (a->_size - 1)];
+      n->_prev = a;
+      _table.store(n, std::memory_order_release);
+      return n;
+    }
+
+  public:
+    // ------------
+    // constructors
+    // ------------
+
+    explicit my_steal_deque (const allocator_type& a = allocator_type()) :
+        _slot_a(a),
+        _chunks_a(a),
+        _top(0),
+        _bottom(0),
+        _table(NULL) {
+      table* t = allocate_table(min_table_size);
+      try {
+        for (size_type i = 0; i != t->_size; ++i)
+          t->_chunks[i] = allocate_chunk();
+      }
+      catch (...) {
+        for (size_type i = 0; i != t->_size; ++i)
+          if (t->_chunks[i])
+            deallocate_chunk(t->_chunks[i]);
+        deallocate_table(t);
+        throw;
+      }
+      _table.store(t, std::memory_order_relaxed);}
+
+    my_steal_deque (const my_steal_deque&) = delete;
+    my_steal_deque& operator = (const my_steal_deque&) = delete;
+
+    // ----------
+    // destructor
+    // ----------
+
+    /**
+     * No thread may be using the deque any more. Every chunk is in the
+     * current table or is some table's orphan.
+     */
+    ~my_steal_deque () {
+      table* t = _table.load(std::memory_order_relaxed);
+      for (size_type i = 0; i != t->_size; ++i)
+        deallocate_chunk(t->_chunks[i]);
+      while (t) {
+        table* p = t->_prev;
+        if (t->_orphan)
+          deallocate_chunk(t->_orphan);
+        deallocate_table(t);
+        t = p;
+      }}
+
+    // -----
+    // empty
+    // -----
+
+    /**
+     * A snapshot; other threads may change it right away.
+     */
+    bool empty () const {
+      return !size();}
+
+    // --------
+    // pop_back
+    // --------
+
+    /**
+     * Owner only: take the most recently pushed element.
+     * @return false, leaving v alone, if the deque was empty or a thief
+     * took the last element first
+     */
+    bool pop_back (reference v) {
+      const difference_type b = _bottom.load(std::memory_order_relaxed) - 1;
+      table* a = _table.load(std::memory_order_relaxed);
+      // Claim slot b before looking at _top; a thief reads them the other
+      // way round, so at most one of us sees the element as available
+      _bottom.store(b, std::memory_order_seq_cst);
+      difference_type t = _top.load(std::memory_order_seq_cst);
+      if (t > b) {
+        _bottom.store(b + 1, std::memory_order_relaxed);
+        return false;
+      }
+      const value_type x = (*a)[b].load(std::memory_order_relaxed);
+      if (t == b) {
+        // The last element: race the thieves for it
+        const bool won = _top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                                      std::memory_order_relaxed);
+        _bottom.store(b + 1, std::memory_order_relaxed);
+        if (!won)
+          return false;
+      }
+      v = x;
+      return true;}
+
+    // ---------
+    // push_back
+    // ---------
+
+    /**
+     * Owner only: push v at the back, doubling the table if it is full.
+     */
+    void push_back (const_reference v) {
+      const difference_type b = _bottom.load(std::memory_order_relaxed);
+      const difference_type t = _top.load(std::memory_order_acquire);
+      table* a = _table.load(std::memory_order_relaxed);
+      if (b - t >= difference_type(a->_size * chunk_size))
+        a = grow(a, t, b);
+      (*a)[b].store(v, std::memory_order_relaxed);
+      _bottom.store(b + 1, std::memory_order_release);}
+
+    // ----
+    // size
+    // ----
+
+    /**
+     * A snapshot; other threads may change it right away.
+     */
+    size_type size () const {
+      const difference_type b = _bottom.load(std::memory_order_acquire);
+      const difference_type t = _top.load(std::memory_order_acquire);
+      return b > t ? b - t : 0;}
+
+    // -----------
+    // steal_front
+    // -----------
+
+    /**
+     * Any thread: take the oldest element.
+     * @return false, leaving v alone, if the deque was empty or another
+     * thread took that element first
+     */
+    bool steal_front (reference v) {
+      difference_type t = _top.load(std::memory_order_seq_cst);
+      const difference_type b = _bottom.load(std::memory_order_seq_cst);
+      if (t >= b)
+        return false;
+      table* a = _table.load(std::memory_order_acquire);
+      const value_type x = (*a)[t].load(std::memory_order_relaxed);
+      if (!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                        std::memory_order_relaxed))
+        return false;
+      v = x;
+      return true;}};
+
+template <typename T, typename A, typename C>
+constexpr typename my_steal_deque<T, A, C>::size_type my_steal_deque<T, A, C>::chunk_size;
+
+template <typename T, typename A, typename C>
+constexpr typename my_steal_deque<T, A, C>::size_type my_steal_deque<T, A, C>::chunk_shift;
+
+template <typename T, typename A, typename C>
+constexpr typename my_steal_deque<T, A, C>::size_type my_steal_deque<T, A, C>::chunk_mask;
+
+template <typename T, typename A, typename C>
+constexpr std::size_t my_steal_deque<T, A, C>::cache_line;
+
+template <typename T, typename A, typename C>
+constexpr typename my_steal_deque<T, A, C>::size_type my_steal_deque<T, A, C>::min_table_size;
+
+// -------------------
+// my_concurrent_deque
+// -------------------
+
+/**
+ * A my_deque shared by any number of producer and consumer threads. One
+ * mutex guards the deque; consumers wait on one condition variable for
+ * elements, producers on another for room when there is a capacity bound.
+ * The batch operations move many elements per lock round trip. close()
+ * wakes everyone up for shutdown: pushes fail from then on, and pops fail
+ * once the remaining elements are gone.
+ */
+template < typename T,
+           typename A = std::allocator<T>,
+           typename C = deque_chunk_bytes<T> >
+class my_concurrent_deque {
+  public:
+    // --------
+    // typedefs
+    // --------
+
+    typedef my_deque<T, A, C>                    deque_type;
+    typedef typename deque_type::allocator_type  allocator_type;
+    typedef typename deque_type::value_type      value_type;
+    typedef typename deque_type::size_type       size_type;
+    typedef typename deque_type::reference       reference;
+    typedef typename deque_type::const_reference const_reference;
+
+  private:
+    // ----
+    // data
+    // ----
+
+    deque_type              _d;
+    size_type               _capacity;  //! 0 for unbounded
+    bool                    _closed;
+    mutable std::mutex      _m;
+    std::condition_variable _not_empty;
+    std::condition_variable _not_full;
+
+  private:
+    typedef std::unique_lock<std::mutex> lock_type;
+
+    // -----
+    // ready
+    // -----
+
+    bool can_pop () const {
+      return !_d.empty() || _closed;}
+
+    bool can_push () const {
+      return !_capacity || (_d.size() < _capacity) || _closed;}
+
+    // ------
+    // pushed
+    // ------
+
+    /**
+     * Wake up as many consumers as there are new elements, after unlocking.
+     */
+    void pushed (lock_type& l, size_type n) {
+      l.unlock();
+      if (n == 1)
+        _not_empty.notify_one();
+      else if (n)
+        _not_empty.notify_all();}
+
+    /**
+     * Wake up as many producers as there is new room, after unlocking.
+     */
+    void popped (lock_type& l, size_type n) {
+      l.unlock();
+      if (!_capacity)
+        return;
+      if (n == 1)
+        _not_full.notify_one();
+      else if (n)
+        _not_full.notify_all();}
+
+    // ----
+    // push
+    // ----
+
+    template <typename... Args>
+    bool push (bool back, Args&&... args) {
+      lock_type l(_m);
+      _not_full.wait(l, [this] () {return can_push();});
+      if (_closed)
+        return false;
+      if (back)
+        _d.emplace_back(std::forward<Args>(args)...);
+      else
+        _d.emplace_front(std::forward<Args>(args)...);
+      pushed(l, 1);
+      return true;}
+
+    // ---
+    // pop
+    // ---
+
+    /**
+     * Take an element from one end once l holds the lock and can_pop().
+     */
+    bool pop (lock_type& l, bool back, reference v) {
+      if (_d.empty())
+        return false;
+      if (back) {
+        v = std::move(_d.back());
+        _d.pop_back();
+      }
+      else {
+        v = std::move(_d.front());
+        _d.pop_front();
+      }
+      popped(l, 1);
+      return true;}
+
+    template <typename Rep, typename Period>
+    bool pop_for (bool back, reference v, const std::chrono::duration<Rep, Period>& d) {
+      lock_type l(_m);
+      if (!_not_empty.wait_for(l, d, [this] () {return can_pop();}))
+        return false;
+      return pop(l, back, v);}
+
+  public:
+    // ------------
+    // constructors
+    // ------------
+
+    /**
+     * @param capacity Most elements held before pushes block; 0 for no bound
+     */
+    explicit my_concurrent_deque (size_type capacity = 0,
+                                  const allocator_type& a = allocator_type()) :
+        _d(a),
+        _capacity(capacity),
+        _closed(false) {}
+
+    my_concurrent_deque (const my_concurrent_deque&) = delete;
+    my_concurrent_deque& operator = (const my_concurrent_deque&) = delete;
+
+    // --------
+    // capacity
+    // --------
+
+    /**
+     * The bound given at construction; 0 for none.
+     */
+    size_type capacity () const {
+      return _capacity;}
+
+    // -----
+    // close
+    // -----
+
+    /**
+     * Fail every push from now on, and every pop once the deque is empty,
+     * waking up all waiting threads.
+     */
+    void close () {
+      {
+        std::lock_guard<std::mutex> g(_m);
+        _closed = true;
+      }
+      _not_empty.notify_all();
+      _not_full.notify_all();}
+
+    bool closed () const {
+      std::lock_guard<std::mutex> g(_m);
+      return _closed;}
+
+    // -----
+    // empty
+    // -----
+
+    /**
+     * A snapshot; other threads may change it right away.
+     */
+    bool empty () const {
+      return !size();}
+
+    // --------
+    // pop_back
+    // --------
+
+    /**
+     * Wait for an element and take it from the back.
+     * @return false if the deque was closed and empty
+     */
+    bool pop_back (reference v) {
+      lock_type l(_m);
+      _not_empty.wait(l, [this] () {return can_pop();});
+      return pop(l, true, v);}
+
+    /**
+     * Wait up to d for an element and take it from the back.
+     * @return false if none arrived in time, or the deque was closed and
+     * empty
+     */
+    template <typename Rep, typename Period>
+    bool pop_back_for (reference v, const std::chrono::duration<Rep, Period>& d) {
+      return pop_for(true, v, d);}
+
+    // ---------
+    // pop_front
+    // ---------
+
+    /**
+     * Wait for an element and take it from the front.
+     * @return false if the deque was closed and empty
+     */
+    bool pop_front (reference v) {
+      lock_type l(_m);
+      _not_empty.wait(l, [this] () {return can_pop();});
+      return pop(l, false, v);}
+
+    /**
+     * Wait up to d for an element and take it from the front.
+     * @return false if none arrived in time, or the deque was closed and
+     * empty
+     */
+    template <typename Rep, typename Period>
+    bool pop_front_for (reference v, const std::chrono::duration<Rep, Period>& d) {
+      return pop_for(false, v, d);}
+
+    // ---------------
+    // pop_front_batch
+    // ---------------
+
+    /**
+     * Wait for at least one element, then move up to n from the front to
+     * x, all under one lock.
+     * @return The number of elements taken; 0 if the deque was closed and
+     * empty
+     */
+    template <typename OI>
+    size_type pop_front_batch (size_type n, OI x) {
+      lock_type l(_m);
+      _not_empty.wait(l, [this] () {return can_pop();});
+      const size_type k = std::min(n, _d.size());
+      std::move(_d.begin(), _d.begin() + k, x);
+      _d.erase(_d.begin(), _d.begin() + k);
+      popped(l, k);
+      return k;}
+
+    // ---------
+    // push_back
+    // ---------
+
+    /**
+     * Wait for room and append a copy of v.
+     * @return false if the deque was closed
+     */
+    bool push_back (const_reference v) {
+      return push(true, v);}
+
+    bool push_back (value_type&& v) {
+      return push(true, std::move(v));}
+
+    // ---------------
+    // push_back_batch
+    // ---------------
+
+    /**
+     * Append the elements of [b, e), taking the lock once for as many of
+     * them as there is room for, and waiting for room for the rest.
+     * @return The number of elements pushed, short of the whole range only
+     * if the deque was closed
+     */
+    template <typename II>
+    size_type push_back_batch (II b, II e) {
+      size_type n = 0;
+      lock_type l(_m);
+      while (b != e) {
+        _not_full.wait(l, [this] () {return can_push();});
+        if (_closed)
+          break;
+        size_type k = 0;
+        for (; (b != e) && (!_capacity || (_d.size() < _capacity)); ++b, ++k)
+          _d.push_back(*b);
+        n += k;
+        pushed(l, k);
+        if (b != e)
+          // Full: consumers got in while unlocked, now wait for room
+          l.lock();
+      }
+      return n;}
+
+    // ----------
+    // push_front
+    // ----------
+
+    /**
+     * Wait for room and prepend a copy of v.
+     * @return false if the deque was closed
+     */
+    bool push_front (const_reference v) {
+      return push(false, v);}
+
+    bool push_front (value_type&& v) {
+      return push(false, std::move(v));}
+
+    // ----
+    // size
+    // ----
+
+    /**
+     * A snapshot; other threads may change it right away.
+     */
+    size_type size () const {
+      std::lock_guard<std::mutex> g(_m);
+      return _d.size();}
+
+    // -------------
+    // try_pop_front
+    // -------------
+
+    /**
+     * Take an element from the front if there is one, without waiting.
+     */
+    bool try_pop_front (reference v) {
+      lock_type l(_m);
+      return pop(l, false, v);}
+
+    // -------------
+    // try_push_back
+    // -------------
+
+    /**
+     * Append a copy of v if there is room, without waiting.
+     */
+    bool try_push_back (const_reference v) {
+      lock_type l(_m);
+      if (_closed || (_capacity && (_d.size() >= _capacity)))
+        return false;
+      _d.push_back(v);
+      pushed(l, 1);
+      return true;}};
+
 #endif // Deque_h
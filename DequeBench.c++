@@ -0,0 +1,845 @@
+// -----------------------------
+// projects/deque/DequeBench.c++
+// Copyright (C) 2014
+// Glenn P. Downing
+// -----------------------------
+
+/*
+To compile the benchmark:
+    % g++ -pedantic -std=c++14 -Wall -O2 -DNDEBUG DequeBench.c++ -o DequeBench -pthread
+
+To run the benchmark:
+    % DequeBench [--json] [--huge] [n]
+
+n defaults to 10^7 and may go up to 10^8 on a machine with enough memory.
+Each generic benchmark runs over the same element types (int, double, and
+a 64-byte payload) for std::deque and my_deque; the payload runs use n/16
+elements so that every type moves about the same number of bytes. With
+--json the results are written to stdout as one JSON document instead of
+a table, for diffing runs across commits. With --huge the pooled deques
+carve their slabs out of transparent huge pages; compare the pool rows
+of runs with and without it.
+*/
+
+// --------
+// includes
+// --------
+
+#include <algorithm> // count, count_if, equal, find, max, min, minmax_element, sort
+#include <atomic>    // atomic
+#include <chrono>    // steady_clock
+#include <cstdlib>   // atol, mkstemp
+#include <cstring>   // strcmp
+#include <functional> // plus
+#include <deque>     // deque
+#include <iomanip>   // setw
+#include <iostream>  // cout, endl
+#include <iterator>  // back_inserter
+#include <memory>    // unique_ptr
+#include <mutex>     // lock_guard, mutex
+#include <numeric>   // accumulate
+#include <string>    // string, to_string
+#include <thread>    // hardware_concurrency, thread, yield
+#include <utility>   // swap
+#include <vector>    // vector
+
+#include <unistd.h>  // close, lseek, unlink, write
+
+#include "Deque.h"
+
+// -----
+// timer
+// -----
+
+/**
+ * Run f once and return the elapsed wall clock time in milliseconds.
+ */
+template <typename F>
+double timer (F f) {
+  const std::chrono::steady_clock::time_point b = std::chrono::steady_clock::now();
+  f();
+  const std::chrono::steady_clock::time_point e = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(e - b).count();}
+
+// ------
+// report
+// ------
+
+/**
+ * One timed run: n operations of benchmark name on container took ms.
+ */
+struct result {
+  std::string container;
+  std::string name;
+  long        n;
+  double      ms;};
+
+std::vector<result> results;
+bool                json = false;
+
+/**
+ * Record a result and, unless the results go out as JSON at the end,
+ * print it as a row of the table.
+ */
+void report (const std::string& container, const std::string& name, long n, double ms) {
+  results.push_back(result{container, name, n, ms});
+  if (json)
+    return;
+  std::cout << std::left  << std::setw(24) << container
+            << std::setw(20) << name
+            << std::right << std::setw(12) << n
+            << std::setw(12) << std::fixed << std::setprecision(2) << ms << " ms"
+            << std::setw(10) << (ms > 0 ? n / ms / 1000 : 0) << " Mops/s"
+            << std::endl;}
+
+/**
+ * Write every recorded result as one JSON document.
+ */
+void report_json (std::ostream& out, long n) {
+  out << "{\n  \"n\": " << n << ",\n  \"results\": [";
+  for (std::size_t i = 0; i != results.size(); ++i) {
+    const result& r = results[i];
+    out << (i ? ",\n" : "\n")
+        << "    {\"container\": \"" << r.container
+        << "\", \"benchmark\": \"" << r.name
+        << "\", \"n\": "    << r.n
+        << ", \"ms\": "      << std::fixed << std::setprecision(3) << r.ms
+        << ", \"mops\": "    << (r.ms > 0 ? r.n / r.ms / 1000 : 0) << "}";}
+  out << "\n  ]\n}" << std::endl;}
+
+// --------
+// elements
+// --------
+
+/**
+ * A trivially copyable element of Bytes bytes, keyed by its first word, to
+ * see how the containers behave when few elements fit in a chunk.
+ */
+template <std::size_t Bytes>
+struct payload {
+  long _key;
+  char _pad[Bytes - sizeof(long)];
+
+  friend bool operator < (const payload& lhs, const payload& rhs) {
+    return lhs._key < rhs._key;}};
+
+/**
+ * Make the element with key i.
+ */
+template <typename T>
+T make (long i) {
+  return static_cast<T>(i);}
+
+template <>
+payload<64> make< payload<64> > (long i) {
+  payload<64> v;
+  v._key = i;
+  std::memset(v._pad, 0, sizeof(v._pad));
+  return v;}
+
+/**
+ * The key of an element, to fold elements of any type into a checksum.
+ */
+template <typename T>
+long key (const T& v) {
+  return long(v);}
+
+template <std::size_t Bytes>
+long key (const payload<Bytes>& v) {
+  return v._key;}
+
+// ------
+// growth
+// ------
+
+/**
+ * Grow a deque of type D to n elements by pushing at the back, at the
+ * front, and alternately at both ends, then shrink one back to empty from
+ * each end.
+ */
+template <typename D>
+void growth (const std::string& container, long n) {
+  report(container, "push_back", n, timer([n] () {
+      D x;
+      for (long i = 0; i < n; ++i)
+        x.push_back(make<typename D::value_type>(i));}));
+
+  report(container, "push_front", n, timer([n] () {
+      D x;
+      for (long i = 0; i < n; ++i)
+        x.push_front(make<typename D::value_type>(i));}));
+
+  report(container, "push_both", n, timer([n] () {
+      D x;
+      for (long i = 0; i < n; ++i) {
+        if (i & 1)
+          x.push_back(make<typename D::value_type>(i));
+        else
+          x.push_front(make<typename D::value_type>(i));}}));
+
+  {
+  D x(n, make<typename D::value_type>(0));
+  report(container, "pop_back", n, timer([&x] () {
+      while (!x.empty())
+        x.pop_back();}));
+  }
+
+  {
+  D x(n, make<typename D::value_type>(0));
+  report(container, "pop_front", n, timer([&x] () {
+      while (!x.empty())
+        x.pop_front();}));
+  }}
+
+// ------
+// access
+// ------
+
+/**
+ * Read n elements of a deque of type D with n elements through operator[]
+ * at pseudo-random indices.
+ */
+template <typename D>
+void access (const std::string& container, long n) {
+  D x;
+  for (long i = 0; i < n; ++i)
+    x.push_back(make<typename D::value_type>(i));
+
+  long sum = 0;
+  report(container, "random []", n, timer([&x, &sum, n] () {
+      unsigned long r = 1;
+      for (long i = 0; i < n; ++i) {
+        r = r * 6364136223846793005ul + 1442695040888963407ul;
+        sum += key(x[(r >> 17) % n]);}}));
+
+  if (sum == 42)
+    std::cout << std::endl;}
+
+// -----
+// churn
+// -----
+
+/**
+ * FIFO churn: n push_back/pop_front pairs over a window of 1000 elements.
+ */
+template <typename D>
+void churn (const std::string& container, long n) {
+  report(container, "fifo", n, timer([n] () {
+      D x;
+      for (long i = 0; i < 1000; ++i)
+        x.push_back(make<typename D::value_type>(i));
+      for (long i = 0; i < n; ++i) {
+        x.push_back(make<typename D::value_type>(i));
+        x.pop_front();}}));}
+
+// -----
+// small
+// -----
+
+/**
+ * Build and tear down n/100 deques of 16 elements each, 100 at a time,
+ * like per-connection queues.
+ */
+template <typename D>
+void small (const std::string& container, long n) {
+  report(container, "small_deques", n / 100, timer([n] () {
+      for (long i = 0; i < n / 10000; ++i) {
+        D x[100];
+        for (int j = 0; j < 100; ++j)
+          for (int k = 0; k < 16; ++k)
+            x[j].push_back(make<typename D::value_type>(k));}}));}
+
+// ----
+// scan
+// ----
+
+/**
+ * Sum a deque of type D with n elements through its iterators, copy it,
+ * swap it with the copy, then sort it with std::sort.
+ */
+template <typename D>
+void scan (const std::string& container, long n) {
+  D x;
+  for (long i = 0; i < n; ++i)
+    x.push_back(make<typename D::value_type>((i * 7919) % n));
+
+  long sum = 0;
+  report(container, "iterate", n, timer([&x, &sum] () {
+      for (typename D::const_iterator b = x.begin(); b != x.end(); ++b)
+        sum += key(*b);}));
+
+  D y;
+  report(container, "copy", n, timer([&x, &y, &sum] () {
+      y = x;
+      sum += key(y.back());}));
+
+  const long swaps = 1000000;
+  report(container, "swap", swaps, timer([&x, &y] () {
+      for (long i = 0; i < swaps; ++i)
+        std::swap(x, y);}));
+
+  report(container, "sort", n, timer([&x] () {
+      std::sort(x.begin(), x.end());}));
+
+  if (sum == 42)
+    std::cout << std::endl;}
+
+// ------
+// middle
+// ------
+
+/**
+ * Insert and erase single elements in the middle of a deque of type D,
+ * then ranges of 1000. The deque is kept at min(n, 10^5) elements, so
+ * each operation shifts the same number of elements whatever n is.
+ */
+template <typename D>
+void middle (const std::string& container, long n) {
+  typedef typename D::value_type value_type;
+  const long m     = std::min(n, 100000L);
+  const long ops   = std::max(1L, n / 1000);
+  const long range = 1000;
+
+  D x;
+  for (long i = 0; i < m; ++i)
+    x.push_back(make<value_type>(i));
+
+  report(container, "middle insert", ops, timer([&x, ops] () {
+      for (long i = 0; i < ops; ++i)
+        x.insert(x.begin() + x.size() / 2, make<value_type>(i));}));
+
+  report(container, "middle erase", ops, timer([&x, ops] () {
+      for (long i = 0; i < ops; ++i)
+        x.erase(x.begin() + x.size() / 2);}));
+
+  const std::vector<value_type> v(range, make<value_type>(0));
+  report(container, "middle insert_range", ops / 10 * range, timer([&x, &v, ops] () {
+      for (long i = 0; i < ops / 10; ++i)
+        x.insert(x.begin() + x.size() / 2, v.begin(), v.end());}));
+
+  report(container, "middle erase_range", ops / 10 * range, timer([&x, ops, range] () {
+      for (long i = 0; i < ops / 10; ++i) {
+        const typename D::iterator b = x.begin() + (x.size() - range) / 2;
+        x.erase(b, b + range);}}));
+
+  if (x.size() != std::size_t(m))
+    std::cout << "middle: lost elements" << std::endl;}
+
+// -----
+// suite
+// -----
+
+/**
+ * Run every generic benchmark for std::deque<T> and my_deque<T>, with the
+ * element type called type in the report.
+ */
+template <typename T>
+void suite (const std::string& type, long n) {
+  const std::string s = "std::deque<" + type + ">";
+  const std::string m = "my_deque<"   + type + ">";
+
+  growth< std::deque<T> >(s, n);
+  growth< my_deque<T>   >(m, n);
+
+  churn< std::deque<T> >(s, n);
+  churn< my_deque<T>   >(m, n);
+
+  access< std::deque<T> >(s, n);
+  access< my_deque<T>   >(m, n);
+
+  scan< std::deque<T> >(s, n);
+  scan< my_deque<T>   >(m, n);
+
+  middle< std::deque<T> >(s, n);
+  middle< my_deque<T>   >(m, n);
+
+  small< std::deque<T> >(s, n);
+  small< my_deque<T>   >(m, n);}
+
+// ------
+// layout
+// ------
+
+/**
+ * Random operator[] and a full scan over a deque of type D with n
+ * elements, to compare chunk placements: plain, aligned, pooled, and
+ * pooled in huge pages.
+ */
+template <typename D>
+void layout (const std::string& container, long n) {
+  D x;
+  for (long i = 0; i < n; ++i)
+    x.push_back(make<typename D::value_type>(i));
+
+  long sum = 0;
+  report(container, "random []", n, timer([&x, &sum, n] () {
+      unsigned long r = 1;
+      for (long i = 0; i < n; ++i) {
+        r = r * 6364136223846793005ul + 1442695040888963407ul;
+        sum += key(x[(r >> 17) % n]);}}));
+  report(container, "iterate", n, timer([&x, &sum] () {
+      for (typename D::const_iterator b = x.begin(); b != x.end(); ++b)
+        sum += key(*b);}));
+  report(container, "sum", n, timer([&x, &sum] () {
+      sum += key(x.sum());}));
+
+  if (sum == 42)
+    std::cout << std::endl;}
+
+// --------
+// parallel
+// --------
+
+/**
+ * Sum and count over a my_deque<T> of n elements with std::accumulate and
+ * std::count_if, then with parallel_reduce and parallel_count_if on 1, 2,
+ * 4, ... threads up to the number of cores.
+ */
+template <typename T>
+void parallel (const std::string& container, long n) {
+  my_deque<T> x;
+  for (long i = 0; i < n; ++i)
+    x.push_back(static_cast<T>(i % 1000));
+
+  T   sum   = 0;
+  long count = 0;
+  report(container, "accumulate", n, timer([&x, &sum] () {
+      sum += std::accumulate(x.begin(), x.end(), T(0));}));
+  report(container, "count_if", n, timer([&x, &count] () {
+      count += std::count_if(x.begin(), x.end(), [] (T v) {return v > T(500);});}));
+
+  const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+  for (unsigned t = 1; ; t = std::min(2 * t, cores)) {
+    report(container, "par_reduce x" + std::to_string(t), n, timer([&x, &sum, t] () {
+        sum += x.parallel_reduce(T(0), std::plus<T>(), t);}));
+    report(container, "par_count_if x" + std::to_string(t), n, timer([&x, &count, t] () {
+        count += x.parallel_count_if([] (T v) {return v > T(500);}, t);}));
+    if (t == cores)
+      break;}
+
+  if ((sum == 42) || (count == 42))
+    std::cout << std::endl;}
+
+// -------
+// kernels
+// -------
+
+/**
+ * Scan a my_deque<T> of n elements with find, count, sum, minmax and ==,
+ * through its iterators with the std algorithms and then with the chunked
+ * member scans at each instruction set level the CPU supports.
+ */
+template <typename T>
+void kernels (const std::string& container, long n) {
+  my_deque<T> x;
+  for (long i = 0; i < n; ++i)
+    x.push_back(static_cast<T>(i % 1000));
+  const my_deque<T> y(x);
+
+  long r = 0;
+  report(container, "std::find", n, timer([&x, &r] () {
+      r += std::find(x.begin(), x.end(), T(-1)) - x.begin();}));
+  report(container, "std::count", n, timer([&x, &r] () {
+      r += std::count(x.begin(), x.end(), T(7));}));
+  report(container, "std::accumulate", n, timer([&x, &r] () {
+      r += long(std::accumulate(x.begin(), x.end(), T(0)));}));
+  report(container, "std::minmax", n, timer([&x, &r] () {
+      r += long(*std::minmax_element(x.begin(), x.end()).second);}));
+  report(container, "std::equal", n, timer([&x, &y, &r] () {
+      r += std::equal(x.begin(), x.end(), y.begin());}));
+
+  const char* const names[] = {"scalar", "sse2", "avx2", "avx512"};
+  const deque_isa best = deque_simd_isa();
+  for (int isa = 0; isa <= int(best); ++isa) {
+    deque_simd_isa(deque_isa(isa));
+    const std::string suffix = std::string(" ") + names[isa];
+    report(container, "find" + suffix, n, timer([&x, &r] () {
+        r += x.find(T(-1)) - x.begin();}));
+    report(container, "count" + suffix, n, timer([&x, &r] () {
+        r += x.count(T(7));}));
+    report(container, "sum" + suffix, n, timer([&x, &r] () {
+        r += long(x.sum());}));
+    report(container, "minmax" + suffix, n, timer([&x, &r] () {
+        r += long(x.minmax().second);}));
+    report(container, "== " + suffix, n, timer([&x, &y, &r] () {
+        r += (x == y);}));}
+  deque_simd_isa(best);
+
+  if (r == 42)
+    std::cout << std::endl;}
+
+// ------
+// window
+// ------
+
+/**
+ * Keep a window over the last 1024 of n values: with a my_deque, pushing
+ * at the back and popping at the front once full, and with a
+ * my_ring_deque, overwriting the oldest.
+ */
+void window (long n) {
+  const std::size_t w = 1024;
+  long sum = 0;
+  report("my_deque<long>", "window", n, timer([n, w, &sum] () {
+      my_deque<long> x;
+      for (long i = 0; i < n; ++i) {
+        if (x.size() == w)
+          x.pop_front();
+        x.push_back(i);}
+      sum += x.front();}));
+
+  report("my_ring_deque<long>", "window", n, timer([n, w, &sum] () {
+      my_ring_deque<long> x(w);
+      for (long i = 0; i < n; ++i)
+        x.push_back_overwrite(i);
+      sum += x.front();}));
+
+  report("my_ring_deque<long,N>", "window", n, timer([n, &sum] () {
+      my_ring_deque<long, std::allocator<long>, 1024> x;
+      for (long i = 0; i < n; ++i)
+        x.push_back_overwrite(i);
+      sum += x.front();}));
+
+  if (sum == 42)
+    std::cout << std::endl;}
+
+// -----
+// batch
+// -----
+
+/**
+ * Ingest n values arriving in batches of 256 and drain them in batches,
+ * one element at a time and with append and drain_front.
+ */
+void batch (long n) {
+  const long        k = 256;
+  std::vector<long> v(k), w(k);
+  long sum = 0;
+  report("my_deque<long>", "batch_single", n, timer([n, k, &v, &w, &sum] () {
+      my_deque<long> x;
+      for (long i = 0; i < n; i += k) {
+        for (long j = 0; j != k; ++j)
+          x.push_back(v[j]);
+        if (x.size() >= 4 * k)
+          for (long j = 0; j != k; ++j) {
+            w[j] = x.front();
+            x.pop_front();}}
+      sum += x.size() + w[0];}));
+
+  report("my_deque<long>", "batch_bulk", n, timer([n, k, &v, &w, &sum] () {
+      my_deque<long> x;
+      for (long i = 0; i < n; i += k) {
+        x.append(v.begin(), v.end());
+        if (x.size() >= 4 * k)
+          x.drain_front(k, w.begin());}
+      sum += x.size() + w[0];}));
+
+  if (sum == 42)
+    std::cout << std::endl;}
+
+// -------
+// handoff
+// -------
+
+/**
+ * Hand n elements from a producer thread to a consumer thread, through a
+ * my_deque behind a mutex and through a my_spsc_deque.
+ */
+void handoff (long n) {
+  report("my_deque+mutex", "handoff", n, timer([n] () {
+      my_deque<long> x;
+      std::mutex     m;
+      std::thread producer([&x, &m, n] () {
+          for (long i = 0; i < n; ++i) {
+            std::lock_guard<std::mutex> g(m);
+            x.push_back(i);}});
+      for (long i = 0; i < n; ) {
+        std::lock_guard<std::mutex> g(m);
+        if (!x.empty()) {
+          x.pop_front();
+          ++i;}}
+      producer.join();}));
+
+  report("my_spsc_deque", "handoff", n, timer([n] () {
+      my_spsc_deque<long> x;
+      std::thread producer([&x, n] () {
+          for (long i = 0; i < n; ++i)
+            x.push_back(i);});
+      for (long i = 0; i < n; ) {
+        if (x.front()) {
+          x.pop_front();
+          ++i;}}
+      producer.join();}));}
+
+// ----------
+// contention
+// ----------
+
+/**
+ * Move n elements through a my_concurrent_deque from p producer threads to
+ * p consumer threads, for p = 1, 2, 4, 8, one element per lock round trip
+ * and then in batches of 64.
+ */
+void contention (long n) {
+  const long batch = 64;
+  for (int p = 1; p <= 8; p *= 2) {
+    for (int batched = 0; batched != 2; ++batched) {
+      const std::string name = (batched ? "batch " : "single ") +
+                               std::to_string(p) + "x" + std::to_string(p);
+      report("my_concurrent", name, n, timer([n, p, batched, batch] () {
+          my_concurrent_deque<long> x(1024);
+          std::vector<std::thread> ts;
+          for (int i = 0; i != p; ++i)
+            ts.push_back(std::thread([&x, n, p, batched, batch] () {
+                std::vector<long> a(batch);
+                for (long k = 0; k < n / p; k += batch) {
+                  const long m = std::min(batch, n / p - k);
+                  if (batched)
+                    x.push_back_batch(a.begin(), a.begin() + m);
+                  else
+                    for (long j = 0; j != m; ++j)
+                      x.push_back(a[j]);}}));
+          std::vector<std::thread> cs;
+          for (int i = 0; i != p; ++i)
+            cs.push_back(std::thread([&x, batched, batch] () {
+                std::vector<long> a;
+                a.reserve(batch);
+                long v;
+                if (batched)
+                  while (x.pop_front_batch(batch, std::back_inserter(a)))
+                    a.clear();
+                else
+                  while (x.pop_front(v)) {}}));
+          for (std::thread& t : ts)
+            t.join();
+          x.close();
+          for (std::thread& t : cs)
+            t.join();}));}}}
+
+// -------------
+// work_stealing
+// -------------
+
+/**
+ * A task for the worker pool below: process the integers in [lo, hi).
+ */
+struct range_task {
+  long lo;
+  long hi;};
+
+/**
+ * Some arithmetic to stand in for real work on one item.
+ */
+long work (long i) {
+  unsigned long h = i;
+  for (int k = 0; k < 16; ++k)
+    h = (h ^ (h >> 13)) * 0x9e3779b97f4a7c15ul;
+  return long(h & 0xff);}
+
+/**
+ * A small worker pool. Each worker owns a my_steal_deque of tasks: it runs
+ * its own newest task first, splitting it in halves and pushing the upper
+ * half while it's bigger than a grain, and when it runs dry it steals the
+ * oldest (so biggest) task of a random victim. Processing n items is timed
+ * with 1, 2, 4, ... workers up to the number of cores.
+ */
+void work_stealing (long n) {
+  const long     grain = 1024;
+  const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+  for (unsigned w = 1; ; w = std::min(2 * w, cores)) {
+    std::atomic<long> remaining(n);
+    std::atomic<long> total(0);
+    report("my_steal_deque", "steal x" + std::to_string(w), n, timer([&] () {
+        std::vector< std::unique_ptr< my_steal_deque<range_task*> > > q;
+        for (unsigned i = 0; i != w; ++i)
+          q.push_back(std::unique_ptr< my_steal_deque<range_task*> >(new my_steal_deque<range_task*>()));
+        q[0]->push_back(new range_task{0, n});
+
+        std::vector<std::thread> workers;
+        for (unsigned id = 0; id != w; ++id)
+          workers.push_back(std::thread([&, id] () {
+              unsigned seed  = id + 1;
+              long     local = 0;
+              while (remaining.load(std::memory_order_relaxed) > 0) {
+                range_task* p;
+                if (!q[id]->pop_back(p)) {
+                  seed = seed * 1103515245u + 12345u;
+                  const unsigned v = (seed >> 16) % w;
+                  if ((v == id) || !q[v]->steal_front(p)) {
+                    std::this_thread::yield();
+                    continue;}}
+                range_task t = *p;
+                delete p;
+                while (t.hi - t.lo > grain) {
+                  const long mid = t.lo + (t.hi - t.lo) / 2;
+                  q[id]->push_back(new range_task{mid, t.hi});
+                  t.hi = mid;}
+                for (long i = t.lo; i != t.hi; ++i)
+                  local += work(i);
+                remaining.fetch_sub(t.hi - t.lo, std::memory_order_relaxed);}
+              total += local;}));
+        for (std::thread& t : workers)
+          t.join();}));
+    if (total == 42)
+      std::cout << std::endl;
+    if (w == cores)
+      break;}}
+
+// --------
+// snapshot
+// --------
+
+/**
+ * Checkpoint a my_deque<double> of n elements to a file under /tmp
+ * element by element and with write_snapshot, then load it back with
+ * read_snapshot and sum it through a my_mapped_deque.
+ */
+void snapshot (long n) {
+  my_deque<double> x;
+  for (long i = 0; i < n; ++i)
+    x.push_back(i);
+  char path[] = "/tmp/DequeBenchXXXXXX";
+  const int fd = ::mkstemp(path);
+  if (fd < 0)
+    return;
+
+  report("my_deque<double>", "write per element", n, timer([&x, fd] () {
+      for (double v : x)
+        if (::write(fd, &v, sizeof(v)) != sizeof(v))
+          break;}));
+  ::lseek(fd, 0, SEEK_SET);
+  report("my_deque<double>", "write_snapshot", n, timer([&x, fd] () {
+      x.write_snapshot(fd);}));
+  ::lseek(fd, 0, SEEK_SET);
+  report("my_deque<double>", "read_snapshot", n, timer([&x, fd] () {
+      x.read_snapshot(fd);}));
+
+  double sum = 0;
+  report("my_mapped_deque", "map+sum", n, timer([&path, &sum] () {
+      const my_mapped_deque<double> y(path);
+      sum = std::accumulate(y.begin(), y.end(), 0.0);}));
+  ::close(fd);
+  ::unlink(path);
+  if (sum == 42)
+    std::cout << std::endl;}
+
+// -----------
+// copy_writer
+// -----------
+
+/**
+ * Take 100 copies of a my_deque<long> of n elements while it keeps
+ * changing at both ends: deep copies, and with deque_shared_chunks,
+ * copy-on-write ones.
+ */
+template <typename D>
+void copy_writer (const char* type, long n) {
+  D x;
+  for (long i = 0; i < n; ++i)
+    x.push_back(i);
+  long sum = 0;
+  report(type, "copy while writing", 100 * n, timer([&x, &sum] () {
+      for (long k = 0; k != 100; ++k) {
+        const D y(x);
+        x.pop_front();
+        x.push_back(k);
+        x[k] = -k;
+        sum += y.back();}}));
+  if (sum == 42)
+    std::cout << std::endl;}
+
+// -------
+// shuttle
+// -------
+
+/**
+ * Copy n bytes from one file under /tmp to another through a
+ * my_deque<char>, reading into a buffer and pushing each byte, then with
+ * fill_from and drain_to straight between the file and the chunks.
+ */
+void shuttle (long n) {
+  char from[] = "/tmp/DequeBenchXXXXXX";
+  char to[]   = "/tmp/DequeBenchXXXXXX";
+  const int in  = ::mkstemp(from);
+  const int out = ::mkstemp(to);
+  if ((in < 0) || (out < 0))
+    return;
+  const std::vector<char> v(n, 'x');
+  if (::write(in, v.data(), n) != n)
+    return;
+
+  report("my_deque<char>", "shuttle per byte", n, timer([in, out] () {
+      my_deque<char> x;
+      char b[65536];
+      ::lseek(in, 0, SEEK_SET);
+      ::lseek(out, 0, SEEK_SET);
+      for (ssize_t r; (r = ::read(in, b, sizeof(b))) > 0; ) {
+        for (ssize_t i = 0; i != r; ++i)
+          x.push_back(b[i]);
+        while (!x.empty()) {
+          const std::size_t k = std::min<std::size_t>(x.size(), sizeof(b));
+          for (std::size_t i = 0; i != k; ++i) {
+            b[i] = x.front();
+            x.pop_front();}
+          if (::write(out, b, k) < 0)
+            return;}}}));
+
+  report("my_deque<char>", "shuttle fill/drain", n, timer([in, out] () {
+      my_deque<char> x;
+      ::lseek(in, 0, SEEK_SET);
+      ::lseek(out, 0, SEEK_SET);
+      while (x.fill_from(in, 65536) > 0)
+        while (!x.empty())
+          x.drain_to(out);}));
+
+  ::close(in);
+  ::close(out);
+  ::unlink(from);
+  ::unlink(to);}
+
+// ----
+// main
+// ----
+
+int main (int argc, char* argv[]) {
+  long n = 10000000;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--json") == 0)
+      json = true;
+    else if (std::strcmp(argv[i], "--huge") == 0)
+      deque_huge_pages(true);
+    else
+      n = std::atol(argv[i]);}
+
+  suite<int>         ("int",       n);
+  suite<double>      ("double",    n);
+  suite< payload<64> >("payload64", n / 16);
+
+  small< my_deque<int, deque_pool_allocator<int> > >("my_deque<int,pool>", n);
+  small< my_deque<int, std::allocator<int>, deque_inline_elements<16> > >("my_deque<int,inline>", n);
+
+  layout< my_deque<int> >                                 ("my_deque<int>",         n);
+  layout< my_deque<int, deque_aligned_allocator<int> > >  ("my_deque<int,aligned>", n);
+  layout< my_deque<int, deque_pool_allocator<int> > >     ("my_deque<int,pool>",    n);
+
+  kernels<int>   ("my_deque<int>",    n);
+  kernels<double>("my_deque<double>", n);
+
+  parallel<int>   ("my_deque<int>",    n);
+  parallel<double>("my_deque<double>", n);
+
+  window(n);
+  batch(n);
+  handoff(n);
+  contention(n);
+  work_stealing(n);
+  snapshot(n);
+  shuttle(n);
+
+  copy_writer< my_deque<long> >("my_deque<long>", n);
+  copy_writer< my_deque<long, std::allocator<long>, deque_shared_chunks<deque_chunk_bytes<long> > > >
+      ("my_deque<long,shared>", n);
+
+  if (json)
+    report_json(std::cout, n);
+  return 0;}
@@ -31,18 +31,42 @@ To run the test:
 
 To obtain coverage of the test:
     % gcov-4.7 -b TestDeque.c++
+
+To stress the concurrent deques under ThreadSanitizer:
+    % g++ -fsanitize=thread -O1 -g -std=c++14 -Wall TestDeque.c++ -o TestDequeTsan -lgtest -lgtest_main -lpthread
+    % TestDequeTsan --gtest_filter='TestMyDeque.Parallel*:TestMySpscDeque*:TestMyStealDeque*:TestMyConcurrentDeque*' --gtest_repeat=20
+
+To also test the my_deque::stats() counters, add -DDEQUE_STATS to either compile.
 */
 
 // --------
 // includes
 // --------
 
-#include <algorithm> // equal
-#include <cstring>   // strcmp
-#include <deque>     // deque
-#include <sstream>   // ostringstream
-#include <stdexcept> // invalid_argument
-#include <string>    // ==
+#include <algorithm>   // count, equal, find, is_sorted, lower_bound, max_element, min, min_element, reverse, sort
+#include <atomic>      // atomic
+#include <chrono>      // milliseconds
+#include <cstdint>     // uintptr_t
+#include <cstdlib>     // mkstemp
+#include <cstring>     // strcmp, strcpy
+#include <deque>       // deque
+#include <functional>  // plus
+#include <iterator>    // back_inserter, istream_iterator, iterator_traits
+#include <memory>      // unique_ptr
+#include <mutex>       // lock_guard, mutex
+#include <numeric>     // accumulate
+#include <sstream>     // istringstream, ostringstream
+#include <stdexcept>   // invalid_argument, out_of_range, runtime_error
+#include <string>      // ==
+#include <system_error> // system_error
+#include <thread>      // thread
+#include <type_traits> // is_same
+#include <utility>     // move
+#include <vector>      // vector
+
+#include <fcntl.h>     // fcntl
+#include <unistd.h>    // close, ftruncate, lseek, pipe, unlink
+
 // #include <cassert>
 
 #include "gtest/gtest.h"
@@ -74,15 +98,105 @@ struct TestDeque : testing::Test {
   typedef typename D::const_reference const_reference;};
 
 // Specify the types of deques for which all of our tests will be run.
-// Here we specify 4 deque types, so each test will get run 4 times.
+// Here we specify 5 deque types, so each test will get run 5 times. The
+// last one uses small chunks so that most tests cross chunk boundaries.
 typedef testing::Types< std::deque<int>,
                         std::deque<double>,
                         my_deque<int>,
-                        my_deque<double> >
+                        my_deque<double>,
+                        my_deque<int, std::allocator<int>, deque_chunk_elements<64> >,
+                        my_deque<int, std::allocator<int>, deque_inline_elements<64> >,
+                        my_deque<int, std::allocator<int>, deque_shared_chunks<deque_chunk_elements<64> > > >
         my_types;
 
 TYPED_TEST_CASE(TestDeque, my_types);
 
+// -------
+// counter
+// -------
+
+// An element type that counts how often it is copied and moved.
+struct counter {
+  static int copies;
+  static int moves;
+
+  int v;
+
+  counter (int v = 0) : v(v) {}
+  counter (const counter& that) : v(that.v) {++copies;}
+  counter (counter&& that) : v(that.v) {++moves;}
+
+  counter& operator = (const counter& that) {
+    v = that.v;
+    ++copies;
+    return *this;}
+
+  counter& operator = (counter&& that) {
+    v = that.v;
+    ++moves;
+    return *this;}
+
+  static void reset () {
+    copies = moves = 0;}};
+
+int counter::copies = 0;
+int counter::moves  = 0;
+
+// -------
+// tracked
+// -------
+
+// An element type without a default constructor that counts how many
+// instances are alive.
+struct tracked {
+  static int live;
+
+  int v;
+
+  explicit tracked (int v) : v(v) {++live;}
+  tracked (const tracked& that) : v(that.v) {++live;}
+  ~tracked () {--live;}
+
+  tracked& operator = (const tracked& that) {
+    v = that.v;
+    return *this;}};
+
+int tracked::live = 0;
+
+// ------------------
+// counting_allocator
+// ------------------
+
+// A std::allocator that counts the calls made to it, by every element type.
+struct allocation_counts {
+  static int allocations;
+  static int deallocations;
+
+  static void reset () {
+    allocations = deallocations = 0;}};
+
+int allocation_counts::allocations   = 0;
+int allocation_counts::deallocations = 0;
+
+template <typename T>
+struct counting_allocator : std::allocator<T> {
+  template <typename U>
+  struct rebind {
+    typedef counting_allocator<U> other;};
+
+  counting_allocator () {}
+
+  template <typename U>
+  counting_allocator (const counting_allocator<U>&) {}
+
+  T* allocate (std::size_t n) {
+    ++allocation_counts::allocations;
+    return std::allocator<T>::allocate(n);}
+
+  void deallocate (T* p, std::size_t n) {
+    ++allocation_counts::deallocations;
+    std::allocator<T>::deallocate(p, n);}};
+
 /*----------------------------------------------------------------------------*\
     DEQUE CLASS TESTS
 \*----------------------------------------------------------------------------*/
@@ -3204,3 +3318,1843 @@ TYPED_TEST(TestDeque, Push_Front_3) {
   x.push_front(2);
   ASSERT_EQ(x[0], 2); 
 }
+
+TEST(TestMyDeque, Chunk_Size_1) {
+  ASSERT_EQ((deque_chunk_bytes<int>::value), 1024u);
+  ASSERT_EQ((deque_chunk_bytes<int>::shift), 10u);
+  ASSERT_EQ((deque_chunk_bytes<int>::mask), 1023u);
+  ASSERT_EQ((deque_chunk_bytes<double>::value), 512u);
+}
+
+TEST(TestMyDeque, Chunk_Size_2) {
+  struct big {
+    char buf[1000];
+  };
+  ASSERT_EQ((deque_chunk_bytes<big>::value), 16u);
+  ASSERT_EQ((deque_chunk_bytes<char, 100>::value), 64u);
+  ASSERT_EQ((deque_chunk_elements<8>::shift), 3u);
+  ASSERT_EQ((deque_chunk_elements<1>::mask), 0u);
+}
+
+TEST(TestMyDeque, Chunk_Size_3) {
+  my_deque<int, std::allocator<int>, deque_chunk_elements<4> > x(10, 3);
+  ASSERT_EQ(x.size(), 10u);
+  for (int i = 0; i < 10; ++i) {
+    x[i] = i;
+  }
+  for (int i = 0; i < 10; ++i) {
+    ASSERT_EQ(x[i], i);
+  }
+}
+
+TYPED_TEST(TestDeque, Push_Both_1) {
+  typedef typename TestFixture::deque_type      deque_type;
+  typedef typename TestFixture::size_type       size_type;
+
+  deque_type x;
+  std::deque<int> y;
+  for (int i = 0; i < 5000; ++i) {
+    if (i % 3) {
+      x.push_back(i);
+      y.push_back(i);
+    }
+    else {
+      x.push_front(i);
+      y.push_front(i);
+    }
+  }
+  ASSERT_EQ(x.size(), y.size());
+  for (size_type j = 0; j < y.size(); ++j) {
+    ASSERT_EQ(x[j], y[j]);
+  }
+}
+
+TYPED_TEST(TestDeque, Push_Both_2) {
+  typedef typename TestFixture::deque_type      deque_type;
+
+  // FIFO churn: the live window walks towards the back of the table
+  deque_type x;
+  for (int i = 0; i < 10000; ++i) {
+    x.push_back(i);
+    if (i % 4 == 3) {
+      x.pop_front();
+      x.pop_front();
+    }
+  }
+  ASSERT_EQ(x.size(), 5000u);
+  ASSERT_EQ(x.front(), 5000);
+  ASSERT_EQ(x.back(), 9999);
+}
+
+TYPED_TEST(TestDeque, Push_Both_3) {
+  typedef typename TestFixture::deque_type      deque_type;
+
+  // LIFO churn at the front
+  deque_type x(3, 7);
+  for (int i = 0; i < 10000; ++i) {
+    x.push_front(i);
+    if (i % 2)
+      x.pop_back();
+  }
+  ASSERT_EQ(x.size(), 5003u);
+  ASSERT_EQ(x.front(), 9999);
+  ASSERT_EQ(x.back(), 4997);
+}
+
+TYPED_TEST(TestDeque, Iterator_Random_Access_1) {
+  typedef typename TestFixture::deque_type      deque_type;
+  typedef typename deque_type::iterator         iterator;
+
+  ASSERT_TRUE((std::is_same<typename std::iterator_traits<iterator>::iterator_category,
+                            std::random_access_iterator_tag>::value));
+
+  deque_type x;
+  for (int i = 0; i < 3000; ++i)
+    x.push_front(i);
+  iterator b = x.begin();
+  iterator e = x.end();
+  ASSERT_EQ(e - b, 3000);
+  ASSERT_EQ(b - e, -3000);
+  ASSERT_TRUE(b < e);
+  ASSERT_TRUE(e > b);
+  ASSERT_TRUE(b <= b);
+  ASSERT_TRUE(e >= b);
+  ASSERT_EQ(b[0], 2999);
+  ASSERT_EQ(b[2999], 0);
+  ASSERT_EQ(*(2000 + b), 999);
+  ASSERT_EQ((e - 1000)[-1], 1000);
+}
+
+TYPED_TEST(TestDeque, Iterator_Random_Access_2) {
+  typedef typename TestFixture::deque_type      deque_type;
+
+  deque_type x;
+  for (int i = 0; i < 5000; ++i)
+    x.push_back((i * 7919) % 5000);
+  std::sort(x.begin(), x.end());
+  for (int i = 0; i < 5000; ++i)
+    ASSERT_EQ(x[i], i);
+  ASSERT_EQ(std::lower_bound(x.begin(), x.end(), 1234) - x.begin(), 1234);
+}
+
+TYPED_TEST(TestDeque, Const_Iterator_Random_Access_1) {
+  typedef typename TestFixture::deque_type      deque_type;
+  typedef typename deque_type::const_iterator   const_iterator;
+
+  deque_type y;
+  for (int i = 0; i < 3000; ++i)
+    y.push_back(i);
+  const deque_type& x = y;
+  const_iterator b = x.begin();
+  const_iterator e = x.end();
+  ASSERT_EQ(e - b, 3000);
+  ASSERT_TRUE(b < e);
+  ASSERT_EQ(b[1500], 1500);
+  ASSERT_TRUE(std::binary_search(b, e, 2999));
+  ASSERT_EQ(std::upper_bound(b, e, 41) - b, 42);
+}
+
+TEST(TestMyDeque, Iterator_Random_Access_3) {
+  // Every += crosses chunks, forwards and backwards
+  my_deque<int, std::allocator<int>, deque_chunk_elements<2> > x;
+  for (int i = 0; i < 101; ++i)
+    x.push_back(i);
+  for (int d = -100; d <= 100; ++d) {
+    const int i = (d < 0) ? 100 : 0;
+    ASSERT_EQ(*((x.begin() + i) + d), i + d);
+    ASSERT_EQ((x.end() - 1 - (100 - i)) - x.begin(), i);
+  }
+  std::reverse(x.begin(), x.end());
+  std::sort(x.begin(), x.end());
+  for (int i = 0; i < 101; ++i)
+    ASSERT_EQ(x[i], i);
+}
+
+TYPED_TEST(TestDeque, Move_Constructor_1) {
+  typedef typename TestFixture::deque_type      deque_type;
+
+  deque_type x;
+  for (int i = 0; i < 3000; ++i)
+    x.push_back(i);
+  deque_type y(std::move(x));
+  ASSERT_EQ(y.size(), 3000u);
+  ASSERT_EQ(y[2999], 2999);
+  ASSERT_TRUE(x.empty());
+}
+
+TYPED_TEST(TestDeque, Move_Constructor_2) {
+  typedef typename TestFixture::deque_type      deque_type;
+
+  // A moved-from deque is still usable
+  deque_type x(10, 3);
+  deque_type y(std::move(x));
+  x.push_front(1);
+  x.push_back(2);
+  x.resize(4, 5);
+  ASSERT_EQ(x.size(), 4u);
+  ASSERT_EQ(x.front(), 1);
+  ASSERT_EQ(x[1], 2);
+  ASSERT_EQ(x.back(), 5);
+  ASSERT_EQ(y.size(), 10u);
+}
+
+TYPED_TEST(TestDeque, Move_Assign_1) {
+  typedef typename TestFixture::deque_type      deque_type;
+
+  deque_type x(100, 4);
+  deque_type y(7, 2);
+  y = std::move(x);
+  ASSERT_EQ(y.size(), 100u);
+  ASSERT_EQ(y.back(), 4);
+  ASSERT_TRUE(x.empty());
+  x = std::move(y);
+  ASSERT_EQ(x.size(), 100u);
+  ASSERT_TRUE(y.empty());
+}
+
+TYPED_TEST(TestDeque, Emplace_1) {
+  typedef typename TestFixture::deque_type      deque_type;
+
+  deque_type x;
+  x.emplace_back(2);
+  x.emplace_front(1);
+  x.emplace_back(4);
+  x.emplace(x.begin() + 2, 3);
+  x.emplace(x.begin(), 0);
+  x.emplace(x.end(), 5);
+  ASSERT_EQ(x.size(), 6u);
+  for (int i = 0; i < 6; ++i)
+    ASSERT_EQ(x[i], i);
+}
+
+TYPED_TEST(TestDeque, Emplace_2) {
+  typedef typename TestFixture::deque_type      deque_type;
+  typedef typename deque_type::iterator         iterator;
+
+  deque_type x;
+  for (int i = 0; i < 1000; ++i)
+    x.push_back(2 * i);
+  iterator i = x.emplace(x.begin() + 500, 999);
+  ASSERT_EQ(*i, 999);
+  ASSERT_EQ(i - x.begin(), 500);
+  ASSERT_EQ(x[499], 998);
+  ASSERT_EQ(x[501], 1000);
+  ASSERT_EQ(x.back(), 1998);
+}
+
+TYPED_TEST(TestDeque, Insert_Range_1) {
+  typedef typename TestFixture::deque_type      deque_type;
+  typedef typename deque_type::iterator         iterator;
+
+  std::deque<int> y;
+  deque_type      x;
+  for (int i = 0; i < 500; ++i) {
+    x.push_back(i);
+    y.push_back(i);
+  }
+  const int a[] = {-1, -2, -3, -4, -5, -6, -7, -8, -9, -10};
+  // Near the front, near the back, and gaps wider than either side
+  const int at[] = {0, 3, 250, 497, 510, 2};
+  for (int p : at) {
+    iterator i = x.insert(x.begin() + p, a, a + 10);
+    y.insert(y.begin() + p, a, a + 10);
+    ASSERT_EQ(i - x.begin(), p);
+    ASSERT_EQ(*i, -1);
+    ASSERT_EQ(x.size(), y.size());
+    ASSERT_TRUE(std::equal(x.begin(), x.end(), y.begin()));
+  }
+  deque_type z(3, 7);
+  z.insert(z.begin() + 1, x.begin(), x.end());
+  ASSERT_EQ(z.size(), x.size() + 3);
+  ASSERT_TRUE(std::equal(x.begin(), x.end(), z.begin() + 1));
+  ASSERT_EQ(z.front(), 7);
+  ASSERT_EQ(z.back(), 7);
+}
+
+TYPED_TEST(TestDeque, Insert_Range_2) {
+  typedef typename TestFixture::deque_type      deque_type;
+
+  deque_type x(4, 0);
+  std::istringstream in("1 2 3 4 5");
+  typename deque_type::iterator i =
+      x.insert(x.begin() + 1, std::istream_iterator<int>(in), std::istream_iterator<int>());
+  ASSERT_EQ(i - x.begin(), 1);
+  const int a[] = {0, 1, 2, 3, 4, 5, 0, 0, 0};
+  ASSERT_EQ(x.size(), 9u);
+  ASSERT_TRUE(std::equal(x.begin(), x.end(), a));
+}
+
+TYPED_TEST(TestDeque, Insert_Fill_1) {
+  typedef typename TestFixture::deque_type      deque_type;
+  typedef typename deque_type::iterator         iterator;
+
+  deque_type x;
+  x.insert(x.begin(), 3, 1);
+  for (int i = 0; i < 100; ++i)
+    x.push_back(2);
+  // The value refers into the deque itself
+  iterator i = x.insert(x.begin() + 1, 200, x[0]);
+  ASSERT_EQ(i - x.begin(), 1);
+  ASSERT_EQ(x.size(), 303u);
+  ASSERT_EQ(std::count(x.begin(), x.end(), 1), 203);
+  ASSERT_EQ(x[202], 1);
+  ASSERT_EQ(x[203], 2);
+  i = x.insert(x.end() - 1, 5, 9);
+  ASSERT_EQ(x.end() - i, 6);
+  ASSERT_EQ(x[x.size() - 2], 9);
+  ASSERT_EQ(x.back(), 2);
+  i = x.insert(x.begin(), 0, 4);
+  ASSERT_EQ(i, x.begin());
+}
+
+TYPED_TEST(TestDeque, Erase_Range_1) {
+  typedef typename TestFixture::deque_type      deque_type;
+  typedef typename deque_type::iterator         iterator;
+
+  std::deque<int> y;
+  deque_type      x;
+  for (int i = 0; i < 1000; ++i) {
+    x.push_back(i);
+    y.push_back(i);
+  }
+  // [p, p + n) near the front, near the back, in the middle, and empty
+  const int at[][2] = {{5, 10}, {900, 50}, {400, 100}, {0, 3}, {10, 0}, {600, 200}};
+  for (const int* r : at) {
+    iterator i = x.erase(x.begin() + r[0], x.begin() + r[0] + r[1]);
+    y.erase(y.begin() + r[0], y.begin() + r[0] + r[1]);
+    ASSERT_EQ(i - x.begin(), r[0]);
+    ASSERT_EQ(*i, y[r[0]]);
+    ASSERT_EQ(x.size(), y.size());
+    ASSERT_TRUE(std::equal(x.begin(), x.end(), y.begin()));
+  }
+  iterator i = x.erase(x.begin(), x.end());
+  ASSERT_TRUE(x.empty());
+  ASSERT_EQ(i, x.end());
+}
+
+TYPED_TEST(TestDeque, Erase_Range_2) {
+  typedef typename TestFixture::deque_type      deque_type;
+  typedef typename deque_type::iterator         iterator;
+
+  deque_type x;
+  for (int i = 0; i < 10; ++i)
+    x.push_back(i);
+  iterator i = x.erase(x.begin() + 2);
+  ASSERT_EQ(*i, 3);
+  i = x.erase(x.end() - 2);
+  ASSERT_EQ(*i, 9);
+  i = x.erase(x.end() - 1);
+  ASSERT_EQ(i, x.end());
+  const int a[] = {0, 1, 3, 4, 5, 6, 7};
+  ASSERT_EQ(x.size(), 7u);
+  ASSERT_TRUE(std::equal(x.begin(), x.end(), a));
+}
+
+TEST(TestMyDeque, Insert_Erase_Range_1) {
+  // Shifting by whole blocks leaves no element unconstructed or leaked
+  std::deque<int> y;
+  {
+    my_deque<tracked, std::allocator<tracked>, deque_chunk_elements<4> > x;
+    for (int i = 0; i < 50; ++i) {
+      x.push_back(tracked(i));
+      y.push_back(i);
+    }
+    for (int k = 0; k < 200; ++k) {
+      const int p = (k * 37) % (int(x.size()) + 1);
+      const int n = (k * 13) % 23;
+      if (k % 3) {
+        x.insert(x.begin() + p, n, tracked(-k));
+        y.insert(y.begin() + p, n, -k);
+      }
+      else {
+        const int m = std::min(n, int(x.size()) - p);
+        x.erase(x.begin() + p, x.begin() + p + m);
+        y.erase(y.begin() + p, y.begin() + p + m);
+      }
+      ASSERT_EQ(tracked::live, int(x.size()));
+      ASSERT_EQ(x.size(), y.size());
+      for (std::size_t i = 0; i != y.size(); ++i)
+        ASSERT_EQ(x[i].v, y[i]);
+    }
+  }
+  ASSERT_EQ(tracked::live, 0);
+}
+
+TYPED_TEST(TestDeque, Range_Constructor_1) {
+  typedef typename TestFixture::deque_type      deque_type;
+
+  std::vector<int> v;
+  for (int i = 0; i < 5000; ++i)
+    v.push_back(i);
+  const deque_type x(v.begin(), v.end());
+  ASSERT_EQ(x.size(), v.size());
+  ASSERT_TRUE(std::equal(x.begin(), x.end(), v.begin()));
+  // From another deque whose elements don't start on a chunk boundary
+  deque_type y(x.begin() + 77, x.end() - 3);
+  ASSERT_EQ(y.size(), 4920u);
+  ASSERT_EQ(y.front(), 77);
+  ASSERT_EQ(y.back(), 4996);
+  std::istringstream in("4 5 6");
+  const deque_type z((std::istream_iterator<int>(in)), std::istream_iterator<int>());
+  ASSERT_EQ(z.size(), 3u);
+  ASSERT_EQ(z[2], 6);
+}
+
+TYPED_TEST(TestDeque, Initializer_List_1) {
+  typedef typename TestFixture::deque_type      deque_type;
+
+  deque_type x = {1, 2, 3};
+  ASSERT_EQ(x.size(), 3u);
+  ASSERT_EQ(x[2], 3);
+  x = {4, 5};
+  ASSERT_EQ(x.size(), 2u);
+  ASSERT_EQ(x[0], 4);
+  x.assign({6, 7, 8, 9});
+  ASSERT_EQ(x.size(), 4u);
+  ASSERT_EQ(x.back(), 9);
+}
+
+TYPED_TEST(TestDeque, Assign_Range_1) {
+  typedef typename TestFixture::deque_type      deque_type;
+
+  deque_type x;
+  for (int i = 0; i < 300; ++i)
+    x.push_front(i);
+  const int a[] = {1, 2, 3, 4, 5};
+  x.assign(a, a + 5);
+  ASSERT_EQ(x.size(), 5u);
+  ASSERT_TRUE(std::equal(x.begin(), x.end(), a));
+  deque_type y;
+  for (int i = 0; i < 3000; ++i)
+    y.push_back(i);
+  x.assign(y.begin() + 1, y.end());
+  ASSERT_EQ(x.size(), 2999u);
+  ASSERT_TRUE(std::equal(x.begin(), x.end(), y.begin() + 1));
+  x.assign(y.begin(), y.begin());
+  ASSERT_TRUE(x.empty());
+}
+
+TYPED_TEST(TestDeque, Assign_Fill_1) {
+  typedef typename TestFixture::deque_type      deque_type;
+
+  deque_type x(10, 1);
+  x.assign(1000, 7);
+  ASSERT_EQ(x.size(), 1000u);
+  ASSERT_EQ(std::count(x.begin(), x.end(), 7), 1000);
+  x.assign(3, 9);
+  ASSERT_EQ(x.size(), 3u);
+  ASSERT_EQ(x[2], 9);
+  std::istringstream in("1 2");
+  x.assign(std::istream_iterator<int>(in), std::istream_iterator<int>());
+  ASSERT_EQ(x.size(), 2u);
+  ASSERT_EQ(x[1], 2);
+}
+
+TEST(TestMyDeque, Assign_Range_2) {
+  // Copies of non-trivial elements assign over what's there, then construct
+  std::vector<tracked> v;
+  for (int i = 0; i < 100; ++i)
+    v.push_back(tracked(i));
+  {
+    my_deque<tracked, std::allocator<tracked>, deque_chunk_elements<4> > x(v.begin(), v.begin() + 10);
+    ASSERT_EQ(tracked::live, 110);
+    x.assign(v.begin(), v.end());
+    ASSERT_EQ(tracked::live, 200);
+    ASSERT_EQ(x[99].v, 99);
+    x.assign(v.begin() + 50, v.begin() + 60);
+    ASSERT_EQ(tracked::live, 110);
+    ASSERT_EQ(x[0].v, 50);
+    my_deque<tracked, std::allocator<tracked>, deque_chunk_elements<4> > y(x);
+    ASSERT_EQ(tracked::live, 120);
+    x = y;
+    ASSERT_EQ(tracked::live, 120);
+  }
+  ASSERT_EQ(tracked::live, 100);
+}
+
+TEST(TestMyDeque, Assign_Range_3) {
+  // Trivially copyable elements go over a chunk at a time, whatever the
+  // offsets of the source and destination chunks
+  my_deque<int, std::allocator<int>, deque_chunk_elements<16> > x;
+  for (int i = 0; i < 1000; ++i)
+    x.push_front(i);
+  for (int k = 0; k < 40; ++k) {
+    my_deque<int, std::allocator<int>, deque_chunk_elements<16> > y;
+    for (int i = 0; i < k; ++i)
+      y.push_front(-i);
+    y.assign(x.begin() + k, x.end() - k);
+    ASSERT_EQ(y.size(), 1000u - 2 * k);
+    ASSERT_TRUE(std::equal(y.begin(), y.end(), x.begin() + k));
+    y = x;
+    ASSERT_TRUE(y == x);
+  }
+}
+
+TEST(TestMyDeque, Move_Only_1) {
+  my_deque<std::unique_ptr<int> > x;
+  for (int i = 0; i < 3000; ++i) {
+    std::unique_ptr<int> p(new int(i));
+    if (i % 2)
+      x.push_back(std::move(p));
+    else
+      x.push_front(std::move(p));
+  }
+  ASSERT_EQ(x.size(), 3000u);
+  ASSERT_EQ(*x.front(), 2998);
+  ASSERT_EQ(*x.back(), 2999);
+  x.pop_back();
+  x.pop_front();
+  ASSERT_EQ(*x.back(), 2997);
+}
+
+TEST(TestMyDeque, Move_Only_2) {
+  my_deque<std::unique_ptr<int> > x;
+  x.emplace_back(new int(1));
+  x.emplace_back(new int(3));
+  x.emplace(x.begin() + 1, new int(2));
+  x.insert(x.begin(), std::unique_ptr<int>(new int(0)));
+  x.erase(x.begin() + 2);
+
+  my_deque<std::unique_ptr<int> > y(std::move(x));
+  ASSERT_EQ(y.size(), 3u);
+  ASSERT_EQ(*y[0], 0);
+  ASSERT_EQ(*y[1], 1);
+  ASSERT_EQ(*y[2], 3);
+  x = std::move(y);
+  x.swap(y);
+  ASSERT_EQ(*y[2], 3);
+}
+
+TEST(TestMyDeque, Move_Counting_1) {
+  my_deque<counter> x;
+  for (int i = 0; i < 100; ++i)
+    x.push_back(counter(i));
+  counter::reset();
+  my_deque<counter> y(std::move(x));
+  ASSERT_EQ(counter::copies, 0);
+  ASSERT_EQ(counter::moves, 0);
+  x = std::move(y);
+  ASSERT_EQ(counter::copies, 0);
+  ASSERT_EQ(counter::moves, 0);
+  ASSERT_EQ(x[99].v, 99);
+}
+
+TEST(TestMyDeque, Move_Counting_2) {
+  my_deque<counter> x;
+  counter::reset();
+  counter c(7);
+  x.push_back(std::move(c));
+  x.push_front(counter(6));
+  x.emplace_back(8);
+  x.emplace(x.begin() + 1, 9);
+  x.erase(x.begin() + 1);
+  ASSERT_EQ(counter::copies, 0);
+  ASSERT_EQ(x[0].v, 6);
+  ASSERT_EQ(x[1].v, 7);
+  ASSERT_EQ(x[2].v, 8);
+}
+
+TEST(TestMyDeque, Lifetime_1) {
+  {
+    my_deque<tracked, std::allocator<tracked>, deque_chunk_elements<4> > x;
+    for (int i = 0; i < 100; ++i) {
+      x.push_back(tracked(i));
+      x.emplace_front(-i);
+      ASSERT_EQ(tracked::live, int(x.size()));
+    }
+    for (int i = 0; i < 30; ++i) {
+      x.pop_front();
+      x.pop_back();
+      ASSERT_EQ(tracked::live, int(x.size()));
+    }
+    x.insert(x.begin() + 10, tracked(5));
+    x.erase(x.begin() + 20);
+    x.resize(50, tracked(1));
+    ASSERT_EQ(tracked::live, 50);
+    x.resize(120, tracked(1));
+    ASSERT_EQ(tracked::live, 120);
+    x.clear();
+    ASSERT_EQ(tracked::live, 0);
+    x.push_back(tracked(3));
+  }
+  ASSERT_EQ(tracked::live, 0);
+}
+
+TEST(TestMyDeque, Lifetime_2) {
+  // Copies and assignments only construct live elements
+  {
+    my_deque<tracked> x(3, tracked(2));
+    ASSERT_EQ(tracked::live, 3);
+    my_deque<tracked> y(x);
+    ASSERT_EQ(tracked::live, 6);
+    y.push_back(tracked(4));
+    x = y;
+    ASSERT_EQ(tracked::live, 8);
+    y.pop_back();
+    y.pop_back();
+    x = y;
+    ASSERT_EQ(tracked::live, 4);
+    x = std::move(y);
+    ASSERT_EQ(tracked::live, 2);
+  }
+  ASSERT_EQ(tracked::live, 0);
+}
+
+TEST(TestMyDeque, Lifetime_3) {
+  // A fresh chunk holds no objects until elements are pushed into it
+  my_deque<counter> x;
+  counter::reset();
+  x.emplace_back(1);
+  x.emplace_front(0);
+  ASSERT_EQ(counter::copies, 0);
+  ASSERT_EQ(counter::moves, 0);
+  ASSERT_EQ(x[0].v, 0);
+  ASSERT_EQ(x[1].v, 1);
+}
+
+TEST(TestMyDeque, Spare_Chunks_1) {
+  // FIFO churn reuses emptied chunks instead of allocating
+  my_deque<int, counting_allocator<int>, deque_chunk_elements<4> > x;
+  for (int i = 0; i < 100; ++i)
+    x.push_back(i);
+  for (int i = 0; i < 1000; ++i) {
+    x.push_back(i);
+    x.pop_front();
+  }
+  allocation_counts::reset();
+  for (int i = 0; i < 100000; ++i) {
+    x.push_back(i);
+    x.pop_front();
+  }
+  ASSERT_EQ(allocation_counts::allocations, 0);
+  ASSERT_EQ(allocation_counts::deallocations, 0);
+  ASSERT_EQ(x.size(), 100u);
+  ASSERT_EQ(x.front(), 99900);
+}
+
+TEST(TestMyDeque, Spare_Chunks_2) {
+  // Pops at one end feed pushes at the other
+  my_deque<int, counting_allocator<int>, deque_chunk_elements<4> > x;
+  x.max_spare_chunks(100);
+  for (int i = 0; i < 40; ++i)
+    x.push_front(i);
+  for (int i = 0; i < 40; ++i)
+    x.pop_back();
+  allocation_counts::reset();
+  for (int i = 0; i < 40; ++i)
+    x.push_back(i);
+  ASSERT_EQ(allocation_counts::allocations, 0);
+  for (int i = 0; i < 40; ++i)
+    ASSERT_EQ(x[i], i);
+}
+
+TEST(TestMyDeque, Spare_Chunks_3) {
+  // Past the high-water mark, emptied chunks are given back
+  my_deque<int, counting_allocator<int>, deque_chunk_elements<4> > x;
+  ASSERT_EQ(x.max_spare_chunks(), x.default_max_spare);
+  for (int i = 0; i < 400; ++i)
+    x.push_back(i);
+  allocation_counts::reset();
+  // 400 elements fill 100 chunks and _e sits in a 101st
+  x.clear();
+  ASSERT_EQ(allocation_counts::deallocations, 100 - int(x.default_max_spare));
+  x.max_spare_chunks(0);
+  ASSERT_EQ(allocation_counts::deallocations, 100);
+  ASSERT_TRUE(x.empty());
+}
+
+TEST(TestMyDeque, Shrink_To_Fit_1) {
+  my_deque<int, counting_allocator<int>, deque_chunk_elements<4> > x;
+  x.max_spare_chunks(1000);
+  for (int i = 0; i < 400; ++i)
+    x.push_back(i);
+  for (int i = 0; i < 390; ++i)
+    x.pop_front();
+  allocation_counts::reset();
+  x.shrink_to_fit();
+  // 97 spare chunks and the old table are released, a new table made
+  ASSERT_EQ(allocation_counts::deallocations, 97 + 1);
+  ASSERT_EQ(allocation_counts::allocations, 1);
+  ASSERT_EQ(x.size(), 10u);
+  for (int i = 0; i < 10; ++i)
+    ASSERT_EQ(x[i], 390 + i);
+  x.push_front(0);
+  x.push_back(0);
+  ASSERT_EQ(x.size(), 12u);
+}
+
+TEST(TestMyDeque, Pool_Allocator_1) {
+  typedef deque_pool_allocator<int> allocator_type;
+  ASSERT_EQ(allocator_type::pool_type::block_size, 4096u);
+
+  my_deque<int, allocator_type> x;
+  for (int i = 0; i < 100000; ++i)
+    x.push_back(i);
+  my_deque<int, allocator_type> y(x);
+  ASSERT_EQ(x, y);
+  for (int i = 0; i < 100000; ++i)
+    y.pop_front();
+  ASSERT_TRUE(y.empty());
+  ASSERT_TRUE(allocator_type::pool_type::slab_count() > 0u);
+}
+
+TEST(TestMyDeque, Pool_Allocator_2) {
+  // Deques sharing a pool swap by exchanging chunk tables
+  typedef deque_pool_allocator<double> allocator_type;
+  my_deque<double, allocator_type> x(5000, 1.0);
+  my_deque<double, allocator_type> y(10, 2.0);
+  const double* p = &x[0];
+  const double* q = &y[0];
+  x.swap(y);
+  ASSERT_EQ(&x[0], q);
+  ASSERT_EQ(&y[0], p);
+  ASSERT_EQ(y.size(), 5000u);
+}
+
+TEST(TestMyDeque, Pool_Allocator_3) {
+  // Blocks can be freed on another thread than the one that allocated them
+  typedef deque_pool_allocator<int> allocator_type;
+  my_deque<int, allocator_type>* x = new my_deque<int, allocator_type>();
+  for (int i = 0; i < 50000; ++i)
+    x->push_back(i);
+  std::thread t([x] () {
+    for (int i = 0; i < 50000; ++i)
+      x->push_back(i);
+    delete x;});
+  t.join();
+  my_deque<int, allocator_type> y(50000, 3);
+  ASSERT_EQ(y.back(), 3);
+}
+
+// -----------------
+// counting_resource
+// -----------------
+
+// A memory resource that counts what it hands out.
+struct counting_resource : deque_memory_resource {
+  int outstanding;
+
+  counting_resource () : outstanding(0) {}
+
+  void* do_allocate (std::size_t bytes, std::size_t) {
+    ++outstanding;
+    return ::operator new(bytes);}
+
+  void do_deallocate (void* p, std::size_t, std::size_t) {
+    --outstanding;
+    ::operator delete(p);}};
+
+TEST(TestMyDeque, Polymorphic_Allocator_1) {
+  typedef deque_polymorphic_allocator<int> allocator_type;
+  counting_resource r;
+  {
+    my_deque<int, allocator_type> x((allocator_type(&r)));
+    for (int i = 0; i < 10000; ++i)
+      x.push_front(i);
+    ASSERT_TRUE(r.outstanding > 0);
+    ASSERT_EQ(x.get_allocator().resource(), &r);
+    my_deque<int, allocator_type> y(x);
+    ASSERT_EQ(y.get_allocator().resource(), &r);
+  }
+  ASSERT_EQ(r.outstanding, 0);
+}
+
+TEST(TestMyDeque, Polymorphic_Allocator_2) {
+  // Unequal resources fall back to moving elements
+  typedef deque_polymorphic_allocator<int> allocator_type;
+  counting_resource r;
+  counting_resource s;
+  {
+    my_deque<int, allocator_type> x(100, 1, allocator_type(&r));
+    my_deque<int, allocator_type> y(3000, 2, allocator_type(&s));
+    x.swap(y);
+    ASSERT_EQ(x.size(), 3000u);
+    ASSERT_EQ(y.size(), 100u);
+    ASSERT_EQ(x.get_allocator().resource(), &r);
+    ASSERT_EQ(x.back(), 2);
+    ASSERT_EQ(y.back(), 1);
+    x = std::move(y);
+    ASSERT_EQ(x.size(), 100u);
+  }
+  ASSERT_EQ(r.outstanding, 0);
+  ASSERT_EQ(s.outstanding, 0);
+}
+
+TEST(TestMyDeque, Polymorphic_Allocator_3) {
+  typedef deque_polymorphic_allocator<int> allocator_type;
+  deque_pool_resource<4096> r;
+  my_deque<int, allocator_type> x((allocator_type(&r)));
+  my_deque<int, allocator_type> y((allocator_type(&r)));
+  for (int i = 0; i < 10000; ++i) {
+    x.push_back(i);
+    y.push_front(i);
+  }
+  const int* p = &x[0];
+  x.swap(y);
+  ASSERT_EQ(&y[0], p);
+  ASSERT_EQ(x.front(), 9999);
+}
+
+TEST(TestMyDeque, Parallel_1) {
+  // Every thread count, including more threads than chunks, with the
+  // first element in the middle of a chunk
+  my_deque<int, std::allocator<int>, deque_chunk_elements<16> > x;
+  for (int i = 1; i <= 500; ++i)
+    x.push_back(i);
+  for (int i = 0; i < 7; ++i)
+    x.push_front(0);
+  for (unsigned t = 1; t <= 64; t *= 2) {
+    ASSERT_EQ(x.parallel_reduce(0L, std::plus<long>(), t), 125250L);
+    ASSERT_EQ(x.parallel_count_if([] (int v) {return v % 2 == 0;}, t), 257u);
+    ASSERT_EQ(x.parallel_reduce(-1, [] (int a, int b) {return std::max(a, b);}, t), 500);
+  }
+  ASSERT_EQ(x.parallel_reduce(7L, std::plus<long>()), 125257L);
+}
+
+TEST(TestMyDeque, Parallel_2) {
+  my_deque<double> x;
+  for (int i = 0; i < 100000; ++i)
+    x.push_back(i);
+  x.parallel_for_each([] (double& v) {v *= 2;}, 4);
+  ASSERT_EQ(x[99999], 199998);
+  my_deque<long> y(x.size());
+  x.parallel_transform(y, [] (double v) {return long(v) + 1;}, 3);
+  ASSERT_EQ(y[0], 1);
+  ASSERT_EQ(y[99999], 199999);
+  x.parallel_transform(x, [] (double v) {return -v;});
+  ASSERT_EQ(x[5], -10);
+  ASSERT_EQ(std::accumulate(x.begin(), x.end(), 0.0),
+            x.parallel_reduce(0.0, std::plus<double>(), 5));
+}
+
+TEST(TestMyDeque, Parallel_3) {
+  // Empty deques, and exceptions make it back to the caller
+  my_deque<int> x;
+  ASSERT_EQ(x.parallel_reduce(3, std::plus<int>()), 3);
+  ASSERT_EQ(x.parallel_count_if([] (int) {return true;}), 0u);
+  for (int i = 0; i < 100000; ++i)
+    x.push_back(i);
+  ASSERT_THROW(x.parallel_for_each([] (int& v) {if (v == 77777) throw std::invalid_argument("v");}, 4),
+               std::invalid_argument);
+}
+
+// Check the scans against the std algorithms for every instruction set,
+// with runs that start and end at every offset in a chunk
+template <typename T>
+void check_scans () {
+  typedef my_deque<T, std::allocator<T>, deque_chunk_elements<64> > deque_type;
+  const deque_isa best = deque_simd_isa();
+  for (int isa = 0; isa <= int(deque_isa::avx512); ++isa) {
+    deque_simd_isa(deque_isa(isa));
+    for (int k = 0; k < 200; k += 7) {
+      deque_type x;
+      for (int i = 0; i < k; ++i)
+        x.push_front(T(i % 50));
+      for (int i = 0; i < 3 * k; ++i)
+        x.push_back(T((i * 7) % 101));
+      std::deque<T> y(x.begin(), x.end());
+      ASSERT_EQ(x.count(T(3)), std::size_t(std::count(y.begin(), y.end(), T(3))));
+      ASSERT_EQ(x.find(T(100)) - x.begin(), std::find(y.begin(), y.end(), T(100)) - y.begin());
+      ASSERT_EQ(x.find(T(127)), x.end());
+      ASSERT_EQ(x.sum(), std::accumulate(y.begin(), y.end(), T(0)));
+      if (!y.empty()) {
+        ASSERT_EQ(x.minmax().first,  *std::min_element(y.begin(), y.end()));
+        ASSERT_EQ(x.minmax().second, *std::max_element(y.begin(), y.end()));
+      }
+      deque_type z(y.begin(), y.end());
+      ASSERT_TRUE(x == z);
+      if (!y.empty()) {
+        z[z.size() / 2] = T(1) + z[z.size() / 2];
+        ASSERT_FALSE(x == z);
+      }
+    }
+  }
+  deque_simd_isa(best);
+}
+
+TEST(TestMyDeque, Scan_1) {
+  check_scans<signed char>();
+  check_scans<unsigned short>();
+  check_scans<int>();
+}
+
+TEST(TestMyDeque, Scan_2) {
+  check_scans<long>();
+  check_scans<float>();
+  check_scans<double>();
+}
+
+TEST(TestMyDeque, Scan_3) {
+  // More matches than a narrow lane can count in one go
+  my_deque<char> x(100000, 'a');
+  x.push_back('b');
+  ASSERT_EQ(x.count('a'), 100000u);
+  ASSERT_EQ(x.find('b') - x.begin(), 100000);
+  ASSERT_EQ(x.minmax().second, 'b');
+  // Non-arithmetic types use the scalar kernel
+  my_deque<std::string> y;
+  y.push_back("x");
+  y.push_back("y");
+  y.push_back("x");
+  ASSERT_EQ(y.count("x"), 2u);
+  ASSERT_EQ(y.find("y") - y.begin(), 1);
+  ASSERT_EQ(y.sum(), "xyx");
+  ASSERT_EQ(y.minmax().second, "y");
+  ASSERT_TRUE(y == my_deque<std::string>(y));
+}
+
+// -----
+// stats
+// -----
+
+TEST(TestMyDeque, Stats_1) {
+  typedef my_deque<int> deque_type;
+  const std::size_t cs = deque_type::chunk_size;
+  deque_type x;
+  for (int i = 0; i != 10000; ++i)
+    x.push_front(i);
+  for (int i = 0; i != 3000; ++i)
+    x.pop_back();
+  const deque_stats s = x.stats();
+  ASSERT_EQ(s.live_slots, 7000u);
+  ASSERT_EQ(s.live_slots + s.dead_front + s.dead_back, s.chunks * cs);
+  ASSERT_LE(s.spare_chunks, x.max_spare_chunks());
+  ASSERT_LE(s.chunks, s.table_capacity);
+  // The chunk table has one more entry, a NULL past the end
+  ASSERT_EQ(s.bytes, s.chunks * cs * sizeof(int) + (s.table_capacity + 1) * sizeof(int*));
+  x.shrink_to_fit();
+  const deque_stats t = x.stats();
+  ASSERT_EQ(t.spare_chunks, 0u);
+  ASSERT_EQ(t.table_capacity, t.chunks);
+  ASSERT_LT(t.dead_front + t.dead_back, 2 * cs);
+}
+
+TEST(TestMyDeque, Stats_2) {
+  my_deque<int> x;
+  for (int i = 0; i != 100000; ++i)
+    x.push_back(i);
+  x.clear();
+  x.shrink_to_fit();
+  const deque_stats s = x.stats();
+#ifdef DEQUE_STATS
+  ASSERT_EQ(s.peak_size, 100000u);
+  ASSERT_GT(s.table_reallocations, 1u);
+  ASSERT_EQ(s.chunk_allocations - s.chunk_deallocations, s.chunks);
+  my_deque<int> y(std::move(x));
+  ASSERT_EQ(y.stats().peak_size, 100000u);
+  ASSERT_EQ(x.stats().peak_size, 0u);
+#else
+  ASSERT_EQ(s.peak_size, 0u);
+  ASSERT_EQ(s.table_reallocations, 0u);
+  ASSERT_EQ(s.chunk_allocations, 0u);
+#endif
+}
+
+TEST(TestMyDeque, Counting_Allocator_1) {
+  typedef deque_counting_allocator<int> allocator_type;
+  deque_allocation_counters c;
+  {
+    my_deque<int, allocator_type> x((allocator_type(c)));
+    for (int i = 0; i != 10000; ++i)
+      x.push_back(i);
+    const deque_stats s = x.stats();
+    // Chunks and the chunk table are both counted
+    ASSERT_EQ(c.bytes.load(), s.bytes);
+    ASSERT_EQ(c.allocations - c.deallocations, s.chunks + 1);
+    my_deque<int, allocator_type> y(x);
+    ASSERT_TRUE(y.get_allocator() == x.get_allocator());
+    ASSERT_EQ(c.bytes.load(), s.bytes + y.stats().bytes);
+  }
+  ASSERT_EQ(c.bytes.load(), 0u);
+  ASSERT_EQ(c.allocations.load(), c.deallocations.load());
+  ASSERT_GT(c.peak_bytes.load(), 10000 * sizeof(int));
+}
+
+// ---------
+// alignment
+// ---------
+
+TEST(TestMyDeque, Aligned_1) {
+  // Page-sized chunks from the pool and the aligned allocator are page aligned
+  my_deque<int, deque_pool_allocator<int> > x;
+  my_deque<int, deque_aligned_allocator<int> > y;
+  for (int i = 0; i != 10000; ++i) {
+    x.push_back(i);
+    y.push_back(i);}
+  for (int i = 0; i < 10000; i += my_deque<int>::chunk_size) {
+    ASSERT_EQ(reinterpret_cast<std::uintptr_t>(&x[i]) % 4096, 0u);
+    ASSERT_EQ(reinterpret_cast<std::uintptr_t>(&y[i]) % 4096, 0u);}
+  ASSERT_EQ(std::accumulate(y.begin(), y.end(), 0L), 49995000L);
+  // Odd-sized chunks are still cache line aligned
+  struct odd {char c[40];};
+  my_deque<odd, deque_aligned_allocator<odd> > z(100);
+  ASSERT_EQ(reinterpret_cast<std::uintptr_t>(&z[0]) % 64, 0u);
+}
+
+TEST(TestMyDeque, Aligned_2) {
+  // Slabs carved while huge pages are on still hand out aligned blocks
+  typedef deque_block_pool<8192> pool_type;
+  const bool was = deque_huge_pages();
+  deque_huge_pages(true);
+  ASSERT_TRUE(deque_huge_pages());
+  std::vector<void*> v;
+  for (int i = 0; i != 300; ++i) {
+    v.push_back(pool_type::allocate());
+    ASSERT_EQ(reinterpret_cast<std::uintptr_t>(v.back()) % 4096, 0u);}
+  for (void* p : v)
+    pool_type::deallocate(p);
+  deque_huge_pages(was);
+}
+
+// ------
+// inline
+// ------
+
+TEST(TestMyDeque, Inline_1) {
+  typedef deque_counting_allocator<int>                               allocator_type;
+  typedef my_deque<int, allocator_type, deque_inline_elements<8> >    deque_type;
+  deque_allocation_counters c;
+  {
+    deque_type x((allocator_type(c)));
+    for (int i = 0; i != 7; ++i)
+      x.push_back(i);
+    x.pop_front();
+    x.push_front(-1);
+    // The inline chunk and table are enough
+    ASSERT_EQ(c.allocations.load(), 0u);
+    for (int i = 7; i != 100; ++i)
+      x.push_back(i);
+    ASSERT_GT(c.allocations.load(), 0u);
+    ASSERT_EQ(x.front(), -1);
+    ASSERT_EQ(x.back(), 99);
+    x.resize(4);
+    x.shrink_to_fit();
+    ASSERT_EQ(c.bytes.load(), 0u);
+    ASSERT_EQ(x.size(), 4u);
+    ASSERT_EQ(x[3], 3);
+  }
+  ASSERT_EQ(c.bytes.load(), 0u);
+  ASSERT_EQ(c.allocations.load(), c.deallocations.load());
+}
+
+TEST(TestMyDeque, Inline_2) {
+  typedef my_deque<std::string, std::allocator<std::string>, deque_inline_elements<4> > deque_type;
+  deque_type x;
+  for (int i = 0; i != 3; ++i)
+    x.push_front(std::to_string(i));
+  // Inline chunk, inline table: everything moves element by element
+  deque_type y(std::move(x));
+  ASSERT_TRUE(x.empty());
+  ASSERT_EQ(y.size(), 3u);
+  ASSERT_EQ(y.front(), "2");
+  ASSERT_EQ(y.back(),  "0");
+  // Inline chunk somewhere in the middle of a heap table
+  for (int i = 3; i != 40; ++i)
+    y.push_back(std::to_string(i));
+  for (int i = 0; i != 40; ++i)
+    y.push_front("f" + std::to_string(i));
+  const std::vector<std::string> v(y.begin(), y.end());
+  deque_type z;
+  z = std::move(y);
+  ASSERT_TRUE(std::equal(v.begin(), v.end(), z.begin()));
+  ASSERT_EQ(z.size(), v.size());
+  z.swap(y);
+  ASSERT_TRUE(z.empty());
+  ASSERT_TRUE(std::equal(v.begin(), v.end(), y.begin()));
+  y.push_back("end");
+  ASSERT_EQ(y.back(), "end");
+}
+
+// --------
+// snapshot
+// --------
+
+/**
+ * A file under /tmp, removed when this goes out of scope.
+ */
+struct temp_file {
+  char path[32];
+  int  fd;
+
+  temp_file () {
+    std::strcpy(path, "/tmp/TestDequeXXXXXX");
+    fd = ::mkstemp(path);}
+
+  ~temp_file () {
+    ::close(fd);
+    ::unlink(path);}};
+
+TEST(TestMyDeque, Snapshot_1) {
+  my_deque<double> x;
+  for (int i = 0; i != 100000; ++i)
+    x.push_back(i * 0.5);
+  for (int i = 0; i != 123; ++i)
+    x.pop_front();
+  for (int i = 0; i != 45; ++i)
+    x.push_front(-i);
+  temp_file f;
+  ASSERT_GE(f.fd, 0);
+  x.write_snapshot(f.fd);
+  ASSERT_EQ(::lseek(f.fd, 0, SEEK_CUR), off_t(64 + x.size() * sizeof(double)));
+
+  ASSERT_EQ(::lseek(f.fd, 0, SEEK_SET), 0);
+  my_deque<double> y(10, 1.0);
+  y.read_snapshot(f.fd);
+  ASSERT_EQ(y.size(), x.size());
+  ASSERT_TRUE(x == y);
+  y.push_front(7);
+  ASSERT_EQ(y.front(), 7);
+}
+
+TEST(TestMyDeque, Snapshot_2) {
+  my_deque<int> x;
+  for (int i = 0; i != 50000; ++i)
+    x.push_front(i);
+  temp_file f;
+  x.write_snapshot(f.fd);
+
+  my_mapped_deque<int> y(f.path);
+  ASSERT_EQ(y.size(), x.size());
+  ASSERT_TRUE(std::equal(y.begin(), y.end(), x.begin()));
+  ASSERT_EQ(y[123], x[123]);
+  ASSERT_EQ(y.front(), 49999);
+  ASSERT_EQ(y.back(), 0);
+  ASSERT_THROW(y.at(50000), std::out_of_range);
+
+  my_mapped_deque<int> z(std::move(y));
+  ASSERT_TRUE(y.empty());
+  ASSERT_EQ(z.size(), 50000u);
+}
+
+TEST(TestMyDeque, Snapshot_3) {
+  temp_file f;
+  my_deque<int>(1000, 3).write_snapshot(f.fd);
+  // Wrong element type
+  ASSERT_THROW(my_mapped_deque<double>(f.path), std::runtime_error);
+  ::lseek(f.fd, 0, SEEK_SET);
+  my_deque<double> x(5, 1.0);
+  ASSERT_THROW(x.read_snapshot(f.fd), std::runtime_error);
+  ASSERT_TRUE(x.empty());
+  // Truncated
+  ASSERT_EQ(::ftruncate(f.fd, 64 + 999 * sizeof(int)), 0);
+  ASSERT_THROW(my_mapped_deque<int>(f.path), std::runtime_error);
+  ::lseek(f.fd, 0, SEEK_SET);
+  my_deque<int> y;
+  ASSERT_THROW(y.read_snapshot(f.fd), std::runtime_error);
+  ASSERT_TRUE(y.empty());
+  // Empty
+  temp_file g;
+  my_deque<int>().write_snapshot(g.fd);
+  ASSERT_TRUE(my_mapped_deque<int>(g.path).empty());
+}
+
+TEST(TestMyDeque, Batch_1) {
+  typedef my_deque<int, std::allocator<int>, deque_chunk_elements<16> > deque_type;
+  std::vector<int> v;
+  for (int i = 0; i != 100; ++i)
+    v.push_back(i);
+  const int a[] = {-3, -2, -1};
+  deque_type x;
+  x.prepend(v.begin(), v.begin() + 10);
+  x.append(v.begin() + 10, v.end());
+  x.prepend(a, a + 3);
+  x.append(a, a + 3);
+  ASSERT_EQ(x.size(), 106u);
+  ASSERT_EQ(x.front(), -3);
+  ASSERT_EQ(x[3], 0);
+  ASSERT_EQ(x[102], 99);
+  ASSERT_EQ(x.back(), -1);
+  // From another deque, starting mid chunk
+  deque_type y(x.begin() + 5, x.end() - 2);
+  deque_type z;
+  z.append(y.begin(), y.end());
+  const deque_type& cy = y;
+  z.prepend(cy.begin(), cy.end());
+  ASSERT_EQ(z.size(), 2 * y.size());
+  ASSERT_TRUE(std::equal(y.begin(), y.end(), z.begin()));
+  ASSERT_TRUE(std::equal(y.begin(), y.end(), z.begin() + y.size()));
+  // From a single pass range
+  std::istringstream in("1 2 3");
+  z.prepend(std::istream_iterator<int>(in), std::istream_iterator<int>());
+  ASSERT_EQ(z[0], 1);
+  ASSERT_EQ(z[2], 3);
+  ASSERT_EQ(z[3], y.front());
+}
+
+TEST(TestMyDeque, Batch_2) {
+  my_deque<int, std::allocator<int>, deque_chunk_elements<16> > x;
+  for (int i = 0; i != 100; ++i)
+    x.push_back(i);
+  x.pop_front_n(37);
+  ASSERT_EQ(x.front(), 37);
+  x.pop_back_n(40);
+  ASSERT_EQ(x.back(), 59);
+  ASSERT_EQ(x.size(), 23u);
+  int a[10];
+  ASSERT_EQ(x.drain_front(10, a), a + 10);
+  ASSERT_EQ(a[9], 46);
+  std::vector<int> v(a, a + 10);
+  ASSERT_EQ(x.front(), 47);
+  x.drain_front(100, std::back_inserter(v));
+  ASSERT_EQ(v.size(), 23u);
+  ASSERT_TRUE(x.empty());
+  x.pop_front_n(0);
+  x.push_front(1);
+  ASSERT_EQ(x.size(), 1u);
+}
+
+TEST(TestMyDeque, Batch_3) {
+  {
+    my_deque<tracked, std::allocator<tracked>, deque_chunk_elements<4> > x;
+    std::vector<tracked> v(50, tracked(1));
+    x.append(v.begin(), v.end());
+    x.prepend(v.begin(), v.begin() + 7);
+    ASSERT_EQ(tracked::live, 107);
+    x.pop_front_n(13);
+    x.pop_back_n(20);
+    ASSERT_EQ(tracked::live, 74);
+    std::vector<tracked> w;
+    x.drain_front(5, std::back_inserter(w));
+    ASSERT_EQ(x.size(), 19u);
+    ASSERT_EQ(tracked::live, 74);
+  }
+  ASSERT_EQ(tracked::live, 0);
+}
+
+TEST(TestMyDeque, Batch_4) {
+  // A throwing copy leaves the deque as it was
+  struct fragile : tracked {
+    explicit fragile (int v) : tracked(v) {}
+    fragile (const fragile& that) : tracked(that) {
+      if (that.v < 0)
+        throw std::runtime_error("fragile");}};
+  {
+    my_deque<fragile, std::allocator<fragile>, deque_chunk_elements<4> > x;
+    for (int i = 0; i != 10; ++i)
+      x.push_back(fragile(i));
+    std::vector<fragile> v;
+    v.reserve(10);
+    for (int i = 0; i != 10; ++i)
+      v.emplace_back(i < 7 ? i : -1);
+    ASSERT_THROW(x.prepend(v.begin() + 5, v.end()), std::runtime_error);
+    ASSERT_THROW(x.prepend(v.begin(), v.end()), std::runtime_error);
+    ASSERT_EQ(x.size(), 10u);
+    ASSERT_EQ(x.front().v, 0);
+    ASSERT_EQ(tracked::live, 20);
+    x.prepend(v.begin(), v.begin() + 7);
+    ASSERT_EQ(x.size(), 17u);
+    ASSERT_EQ(x[6].v, 6);
+  }
+  ASSERT_EQ(tracked::live, 0);
+}
+
+TEST(TestMyDeque, Segments_1) {
+  typedef my_deque<int, std::allocator<int>, deque_chunk_elements<16> > deque_type;
+  deque_type x;
+  for (int i = 0; i != 100; ++i)
+    x.push_back(i);
+  for (int i = 0; i != 7; ++i)
+    x.push_front(-i - 1);
+  std::vector<int> v;
+  std::size_t n = 0;
+  for (deque_segment<int*> s : x.segments()) {
+    ASSERT_GT(s.size, 0u);
+    ASSERT_LE(s.size, deque_type::chunk_size);
+    v.insert(v.end(), s.begin(), s.end());
+    ++n;}
+  ASSERT_EQ(n, 8u);
+  ASSERT_TRUE(std::equal(v.begin(), v.end(), x.begin()));
+  ASSERT_EQ(v.size(), x.size());
+  // Writable through a non-const deque
+  for (deque_segment<int*> s : x.segments(x.begin() + 20, x.begin() + 30))
+    std::fill(s.begin(), s.end(), 0);
+  ASSERT_EQ(std::count(x.begin(), x.end(), 0), 11);
+}
+
+TEST(TestMyDeque, Segments_2) {
+  typedef my_deque<int, std::allocator<int>, deque_chunk_elements<16> > deque_type;
+  const deque_type x(40, 2);
+  const deque_type::const_segments_type r = x.segments(x.begin() + 3, x.begin() + 5);
+  deque_type::const_segments_type::iterator i = r.begin();
+  ASSERT_EQ((*i).data, &x[3]);
+  ASSERT_EQ((*i).size, 2u);
+  ASSERT_EQ(++i, r.end());
+  ASSERT_TRUE(x.segments(x.end(), x.end()).empty());
+  ASSERT_TRUE(deque_type().segments().empty());
+  int sum = 0;
+  for (deque_segment<const int*> s : x.segments())
+    sum = std::accumulate(s.data, s.data + s.size, sum);
+  ASSERT_EQ(sum, 80);
+}
+
+TEST(TestMyDeque, Scatter_Gather_1) {
+  int p[2];
+  ASSERT_EQ(::pipe(p), 0);
+  my_deque<char, std::allocator<char>, deque_chunk_elements<16> > x;
+  const std::string s = "the quick brown fox jumps over the lazy dog";
+  x.append(s.begin(), s.end());
+  x.pop_front_n(4);
+  ASSERT_EQ(x.drain_to(p[1], 10), 10);
+  ASSERT_EQ(x.size(), s.size() - 14);
+  ASSERT_EQ(x.front(), 'n');
+  ASSERT_EQ(x.drain_to(p[1]), ssize_t(s.size() - 14));
+  ASSERT_TRUE(x.empty());
+  ASSERT_EQ(::close(p[1]), 0);
+
+  my_deque<char, std::allocator<char>, deque_chunk_elements<16> > y(3, '>');
+  ASSERT_EQ(y.fill_from(p[0], 5), 5);
+  ASSERT_EQ(y.fill_from(p[0], 1000), ssize_t(s.size() - 9));
+  ASSERT_EQ(y.fill_from(p[0], 1000), 0);
+  ASSERT_EQ(std::string(y.begin(), y.end()), ">>>" + s.substr(4));
+  ASSERT_EQ(::close(p[0]), 0);
+}
+
+TEST(TestMyDeque, Scatter_Gather_2) {
+  struct record {
+    int    id;
+    double value;};
+  temp_file f;
+  my_deque<record, std::allocator<record>, deque_chunk_elements<8> > x;
+  for (int i = 0; i != 1000; ++i)
+    x.push_back(record{i, i * 0.5});
+  while (!x.empty())
+    ASSERT_GT(x.drain_to(f.fd), 0);
+  ASSERT_EQ(::lseek(f.fd, 0, SEEK_SET), 0);
+  my_deque<record, std::allocator<record>, deque_chunk_elements<8> > y;
+  while (y.fill_from(f.fd, 300) > 0) {}
+  ASSERT_EQ(y.size(), 1000u);
+  ASSERT_EQ(y[777].id, 777);
+  ASSERT_EQ(y.back().value, 499.5);
+  // A record cut short
+  ASSERT_EQ(::ftruncate(f.fd, 10 * sizeof(record) + 3), 0);
+  ASSERT_EQ(::lseek(f.fd, 0, SEEK_SET), 0);
+  ASSERT_EQ(y.fill_from(f.fd, 10), 10);
+  ASSERT_THROW(y.fill_from(f.fd, 10), std::runtime_error);
+  ASSERT_EQ(y.size(), 1010u);
+}
+
+TEST(TestMyDeque, Scatter_Gather_3) {
+  int p[2];
+  ASSERT_EQ(::pipe(p), 0);
+  ASSERT_EQ(::fcntl(p[0], F_SETFL, O_NONBLOCK), 0);
+  my_deque<int> x;
+  ASSERT_EQ(x.fill_from(p[0], 10), -1);
+  ASSERT_TRUE(x.empty());
+  ASSERT_EQ(x.drain_to(p[1]), 0);
+  ASSERT_THROW(x.fill_from(-1, 10), std::system_error);
+  ::close(p[0]);
+  ::close(p[1]);
+}
+
+TEST(TestMyDeque, Shared_1) {
+  typedef my_deque<int, counting_allocator<int>, deque_shared_chunks<deque_chunk_elements<16> > > deque_type;
+  deque_type x;
+  for (int i = 0; i != 1000; ++i)
+    x.push_back(i);
+  allocation_counts::reset();
+  const deque_type y(x);
+  // Only the chunk table
+  ASSERT_EQ(allocation_counts::allocations, 1);
+  ASSERT_TRUE(x == y);
+  // Each write clones just the chunk it lands in
+  x[500] = -1;
+  ASSERT_EQ(allocation_counts::allocations, 2);
+  x.front() = -2;
+  x.back()  = -3;
+  ASSERT_EQ(allocation_counts::allocations, 4);
+  ASSERT_EQ(y[500], 500);
+  ASSERT_EQ(y.front(), 0);
+  ASSERT_EQ(y.back(), 999);
+  ASSERT_EQ(x[500], -1);
+  for (int i = 0; i != 100; ++i) {
+    x.pop_front();
+    x.push_back(i);}
+  ASSERT_EQ(y.size(), 1000u);
+  for (int i = 0; i != 1000; ++i)
+    ASSERT_EQ(y[i], i);
+  // Mutable iterators own everything
+  std::sort(x.begin(), x.end());
+  ASSERT_TRUE(std::is_sorted(x.begin(), x.end()));
+  ASSERT_EQ(y[0], 0);
+  ASSERT_EQ(y[999], 999);
+}
+
+TEST(TestMyDeque, Shared_2) {
+  typedef my_deque<int, counting_allocator<int>, deque_shared_chunks<deque_chunk_elements<4> > > deque_type;
+  allocation_counts::reset();
+  {
+    deque_type x;
+    for (int i = 0; i != 50; ++i)
+      x.push_front(i);
+    deque_type y;
+    y.push_back(7);
+    y = x;
+    deque_type z(y);
+    y.erase(y.begin() + 10, y.begin() + 20);
+    z.insert(z.begin() + 3, 5, -1);
+    x.swap(z);
+    ASSERT_EQ(x.size(), 55u);
+    ASSERT_EQ(y.size(), 40u);
+    ASSERT_EQ(z.size(), 50u);
+    ASSERT_EQ(x[3], -1);
+    ASSERT_EQ(y[10], 29);
+    ASSERT_EQ(z[10], 39);
+    deque_type w(std::move(z));
+    w.push_back(100);
+    w.push_front(-100);
+    ASSERT_EQ(w.front(), -100);
+    ASSERT_EQ(x[7], -1);
+    ASSERT_EQ(x[8], 46);
+  }
+  ASSERT_EQ(allocation_counts::allocations, allocation_counts::deallocations);
+}
+
+TEST(TestMyDeque, Shared_3) {
+  // A reporting thread reads a snapshot while the writer carries on
+  typedef my_deque<long, std::allocator<long>, deque_shared_chunks<deque_chunk_elements<64> > > deque_type;
+  deque_type x;
+  for (long i = 0; i != 100000; ++i)
+    x.push_back(i);
+  for (int k = 0; k != 4; ++k) {
+    const deque_type y(x);
+    long sum = 0;
+    std::thread t([&y, &sum] () {
+        for (long v : y)
+          sum += v;});
+    for (long i = 0; i != 10000; ++i) {
+      x.pop_front();
+      x.push_back(i);
+      x[i * 7 % 1000] = -i;}
+    t.join();
+    ASSERT_EQ(sum, y.sum());
+    ASSERT_EQ(y.size(), 100000u);}
+}
+
+// --------------
+// my_spill_deque
+// --------------
+
+TEST(TestMySpillDeque, Push_Pop_1) {
+  typedef my_spill_deque<long> deque_type;
+  const std::size_t cs = deque_type::chunk_size;
+  // No budget: only the three hot chunks at each end stay in memory
+  deque_type x(0, "/tmp", 2);
+  for (long i = 0; i != long(100 * cs); ++i) {
+    x.push_back(i);
+    ASSERT_LE(x.resident_chunks(), 6u);}
+  ASSERT_EQ(x.size(), 100 * cs);
+  ASSERT_EQ(x.resident_chunks() + x.spilled_chunks(), 100u);
+  ASSERT_EQ(x.front(), 0);
+  ASSERT_EQ(x.back(), long(100 * cs - 1));
+  for (long i = 0; i != long(100 * cs); ++i) {
+    ASSERT_EQ(x.front(), i);
+    x.pop_front();
+    ASSERT_LE(x.resident_chunks(), 6u);}
+  ASSERT_TRUE(x.empty());
+  ASSERT_EQ(x.spilled_chunks(), 0u);
+}
+
+TEST(TestMySpillDeque, Push_Pop_2) {
+  // Mixed pushes and pops at both ends against std::deque
+  typedef my_spill_deque<int> deque_type;
+  deque_type      x(8 * deque_type::chunk_size * sizeof(int), "/tmp", 1);
+  std::deque<int> y;
+  std::size_t spilled = 0;
+  unsigned    r       = 1;
+  for (int i = 0; i != 200000; ++i) {
+    r = r * 1103515245u + 12345u;
+    const unsigned op = (r >> 16) % 10;
+    if ((op < 3) || y.empty()) {
+      x.push_back(i);
+      y.push_back(i);}
+    else if (op < 6) {
+      x.push_front(i);
+      y.push_front(i);}
+    else if (op < 8) {
+      ASSERT_EQ(x.front(), y.front());
+      x.pop_front();
+      y.pop_front();}
+    else {
+      ASSERT_EQ(x.back(), y.back());
+      x.pop_back();
+      y.pop_back();}
+    ASSERT_EQ(x.size(), y.size());
+    ASSERT_LE(x.resident_chunks(), 8u);
+    spilled = std::max(spilled, x.spilled_chunks());}
+  ASSERT_GT(spilled, 10u);
+  while (!y.empty()) {
+    ASSERT_EQ(x.front(), y.front());
+    x.pop_front();
+    y.pop_front();}
+  ASSERT_TRUE(x.empty());
+}
+
+// -------------
+// my_ring_deque
+// -------------
+
+TEST(TestMyRingDeque, Push_Pop_1) {
+  my_ring_deque<int> x(5);
+  ASSERT_EQ(x.capacity(), 8u);
+  for (int i = 0; i != 8; ++i)
+    ASSERT_TRUE(x.try_push_back(i));
+  ASSERT_TRUE(x.full());
+  ASSERT_FALSE(x.try_push_back(8));
+  ASSERT_FALSE(x.try_push_front(-1));
+  x.pop_front();
+  ASSERT_TRUE(x.try_push_front(-1));
+  ASSERT_EQ(x.front(), -1);
+  ASSERT_EQ(x.back(), 7);
+  x.pop_back();
+  x.pop_front();
+  ASSERT_EQ(x.size(), 6u);
+  ASSERT_EQ(x[0], 1);
+  ASSERT_EQ(x.at(5), 6);
+  ASSERT_THROW(x.at(6), std::out_of_range);
+}
+
+TEST(TestMyRingDeque, Overwrite_1) {
+  // A window over the last 16 of 1000 values, wrapping many times
+  my_ring_deque<int, std::allocator<int>, 16> x;
+  ASSERT_EQ(x.capacity(), 16u);
+  for (int i = 0; i != 1000; ++i)
+    x.push_back_overwrite(i);
+  ASSERT_EQ(x.size(), 16u);
+  ASSERT_EQ(x.front(), 984);
+  ASSERT_EQ(x.back(), 999);
+  ASSERT_EQ(std::accumulate(x.begin(), x.end(), 0), 16 * 984 + 120);
+  const my_ring_deque<int, std::allocator<int>, 16>& y = x;
+  ASSERT_EQ(y.end() - y.begin(), 16);
+  ASSERT_EQ(*(y.begin() + 3), 987);
+  ASSERT_TRUE(std::is_sorted(x.begin(), x.end()));
+  std::reverse(x.begin(), x.end());
+  ASSERT_EQ(x.front(), 999);
+  std::sort(x.begin(), x.end());
+  ASSERT_EQ(x.front(), 984);
+}
+
+TEST(TestMyRingDeque, Allocation_1) {
+  typedef deque_counting_allocator<std::string> allocator_type;
+  deque_allocation_counters c;
+  {
+    my_ring_deque<std::string, allocator_type> x(4, allocator_type(c));
+    ASSERT_EQ(c.allocations.load(), 1u);
+    for (int i = 0; i != 100; ++i)
+      x.push_back_overwrite(std::string(40, char('a' + i % 26)));
+    x.pop_front();
+    ASSERT_TRUE(x.try_push_front("front"));
+    // Strings allocate through their own allocator, the ring never again
+    ASSERT_EQ(c.allocations.load(), 1u);
+    my_ring_deque<std::string, allocator_type> y(x);
+    ASSERT_EQ(c.allocations.load(), 2u);
+    ASSERT_TRUE(std::equal(x.begin(), x.end(), y.begin()));
+    my_ring_deque<std::string, allocator_type> z(std::move(x));
+    ASSERT_EQ(z.size(), 4u);
+    ASSERT_EQ(z.front(), "front");
+    ASSERT_TRUE(x.empty());
+    x = z;
+    ASSERT_EQ(x.back(), y.back());
+  }
+  ASSERT_EQ(c.allocations.load(), c.deallocations.load());
+}
+
+// -------------
+// my_spsc_deque
+// -------------
+
+TEST(TestMySpscDeque, Push_Pop_1) {
+  my_spsc_deque<int, std::allocator<int>, deque_chunk_elements<4> > x;
+  ASSERT_TRUE(x.empty());
+  int v = -1;
+  ASSERT_FALSE(x.try_pop_front(v));
+  ASSERT_EQ(v, -1);
+  for (int k = 0; k < 3; ++k) {
+    for (int i = 0; i < 100; ++i)
+      x.push_back(i);
+    ASSERT_EQ(*x.front(), 0);
+    for (int i = 0; i < 100; ++i) {
+      ASSERT_TRUE(x.try_pop_front(v));
+      ASSERT_EQ(v, i);
+    }
+    ASSERT_TRUE(x.empty());
+  }
+}
+
+TEST(TestMySpscDeque, Lifetime_1) {
+  {
+    my_spsc_deque<tracked, std::allocator<tracked>, deque_chunk_elements<4> > x;
+    for (int i = 0; i < 50; ++i)
+      x.emplace_back(i);
+    ASSERT_EQ(tracked::live, 50);
+    for (int i = 0; i < 30; ++i) {
+      ASSERT_EQ(x.front()->v, i);
+      x.pop_front();
+    }
+    ASSERT_EQ(tracked::live, 20);
+  }
+  ASSERT_EQ(tracked::live, 0);
+}
+
+TEST(TestMySpscDeque, Move_Only_1) {
+  my_spsc_deque<std::unique_ptr<int> > x;
+  x.push_back(std::unique_ptr<int>(new int(7)));
+  std::unique_ptr<int> p;
+  ASSERT_TRUE(x.try_pop_front(p));
+  ASSERT_EQ(*p, 7);
+}
+
+TEST(TestMySpscDeque, Threads_1) {
+  // One producer, one consumer; every element arrives once and in order.
+  // Small chunks make both threads cross chunk boundaries and recycle
+  // spares constantly.
+  const int n = 200000;
+  my_spsc_deque<int, std::allocator<int>, deque_chunk_elements<16> > x;
+  std::thread producer([&x, n] () {
+      for (int i = 0; i < n; ++i)
+        x.push_back(i);});
+  int expected = 0;
+  while (expected != n) {
+    int v;
+    if (x.try_pop_front(v)) {
+      ASSERT_EQ(v, expected);
+      ++expected;
+    }
+    else
+      std::this_thread::yield();
+  }
+  producer.join();
+  ASSERT_TRUE(x.empty());
+}
+
+TEST(TestMySpscDeque, Threads_2) {
+  // Non-trivial elements are constructed by one thread and destroyed by
+  // the other
+  const int n = 50000;
+  {
+    my_spsc_deque<std::unique_ptr<int>, std::allocator<std::unique_ptr<int> >,
+                  deque_chunk_elements<8> > x;
+    std::thread producer([&x, n] () {
+        for (int i = 0; i < n; ++i)
+          x.emplace_back(new int(i));});
+    long sum = 0;
+    for (int i = 0; i < n / 2; ) {
+      std::unique_ptr<int>* p = x.front();
+      if (p) {
+        sum += **p;
+        x.pop_front();
+        ++i;
+      }
+    }
+    producer.join();
+    ASSERT_EQ(sum, long(n / 2) * (n / 2 - 1) / 2);
+  }
+}
+
+// --------------
+// my_steal_deque
+// --------------
+
+TEST(TestMyStealDeque, Push_Pop_1) {
+  // The owner sees a stack, thieves see a queue
+  my_steal_deque<int> x;
+  int v = -1;
+  ASSERT_FALSE(x.pop_back(v));
+  ASSERT_FALSE(x.steal_front(v));
+  ASSERT_EQ(v, -1);
+  for (int i = 0; i < 10; ++i)
+    x.push_back(i);
+  ASSERT_EQ(x.size(), 10u);
+  ASSERT_TRUE(x.pop_back(v));
+  ASSERT_EQ(v, 9);
+  ASSERT_TRUE(x.steal_front(v));
+  ASSERT_EQ(v, 0);
+  ASSERT_TRUE(x.steal_front(v));
+  ASSERT_EQ(v, 1);
+  ASSERT_TRUE(x.pop_back(v));
+  ASSERT_EQ(v, 8);
+  ASSERT_EQ(x.size(), 6u);
+  while (x.pop_back(v)) {}
+  ASSERT_TRUE(x.empty());
+}
+
+TEST(TestMyStealDeque, Grow_1) {
+  // Grow with the live elements starting on and off chunk boundaries
+  for (int off = 0; off < 10; ++off) {
+    my_steal_deque<int, std::allocator<int>, deque_chunk_elements<4> > x;
+    int v;
+    for (int i = 0; i < off; ++i)
+      x.push_back(-1);
+    for (int i = 0; i < off; ++i)
+      ASSERT_TRUE(x.steal_front(v));
+    for (int i = 0; i < 1000; ++i)
+      x.push_back(i);
+    for (int i = 0; i < 500; ++i) {
+      ASSERT_TRUE(x.steal_front(v));
+      ASSERT_EQ(v, i);
+    }
+    for (int i = 1000; i < 3000; ++i)
+      x.push_back(i);
+    for (int i = 2999; i >= 500; --i) {
+      ASSERT_TRUE(x.pop_back(v));
+      ASSERT_EQ(v, i);
+    }
+    ASSERT_TRUE(x.empty());
+  }
+}
+
+TEST(TestMyStealDeque, Threads_1) {
+  // The owner pushes and pops while thieves steal; every element is taken
+  // exactly once
+  const int n       = 200000;
+  const int thieves = 3;
+  my_steal_deque<int, std::allocator<int>, deque_chunk_elements<16> > x;
+  std::vector<char>  taken(n, 0);
+  std::atomic<bool>  done(false);
+  std::atomic<int>   stolen(0);
+  std::vector<std::thread> ts;
+  for (int k = 0; k < thieves; ++k)
+    ts.push_back(std::thread([&] () {
+        int v;
+        while (!done.load()) {
+          if (x.steal_front(v)) {
+            ++taken[v];
+            ++stolen;
+          }
+        }
+        while (x.steal_front(v)) {
+          ++taken[v];
+          ++stolen;
+        }}));
+  int popped = 0;
+  for (int i = 0; i < n; ++i) {
+    x.push_back(i);
+    int v;
+    if ((i % 3 == 0) && x.pop_back(v)) {
+      ++taken[v];
+      ++popped;
+    }
+  }
+  int v;
+  while (x.pop_back(v)) {
+    ++taken[v];
+    ++popped;
+  }
+  done = true;
+  for (std::thread& t : ts)
+    t.join();
+  ASSERT_EQ(popped + stolen.load(), n);
+  ASSERT_EQ(std::count(taken.begin(), taken.end(), 1), n);
+}
+
+// -------------------
+// my_concurrent_deque
+// -------------------
+
+TEST(TestMyConcurrentDeque, Push_Pop_1) {
+  my_concurrent_deque<int> x;
+  ASSERT_TRUE(x.push_back(2));
+  ASSERT_TRUE(x.push_front(1));
+  ASSERT_TRUE(x.push_back(3));
+  ASSERT_EQ(x.size(), 3u);
+  int v;
+  ASSERT_TRUE(x.pop_back(v));
+  ASSERT_EQ(v, 3);
+  ASSERT_TRUE(x.pop_front(v));
+  ASSERT_EQ(v, 1);
+  ASSERT_TRUE(x.try_pop_front(v));
+  ASSERT_EQ(v, 2);
+  ASSERT_FALSE(x.try_pop_front(v));
+  ASSERT_FALSE(x.pop_front_for(v, std::chrono::milliseconds(1)));
+  ASSERT_FALSE(x.pop_back_for(v, std::chrono::milliseconds(1)));
+  ASSERT_TRUE(x.empty());
+}
+
+TEST(TestMyConcurrentDeque, Batch_1) {
+  my_concurrent_deque<int> x;
+  std::vector<int> a;
+  for (int i = 0; i < 100; ++i)
+    a.push_back(i);
+  ASSERT_EQ(x.push_back_batch(a.begin(), a.end()), 100u);
+  std::vector<int> b;
+  ASSERT_EQ(x.pop_front_batch(30, std::back_inserter(b)), 30u);
+  ASSERT_EQ(x.pop_front_batch(300, std::back_inserter(b)), 70u);
+  ASSERT_TRUE(a == b);
+}
+
+TEST(TestMyConcurrentDeque, Capacity_1) {
+  my_concurrent_deque<int> x(2);
+  ASSERT_EQ(x.capacity(), 2u);
+  ASSERT_TRUE(x.try_push_back(1));
+  ASSERT_TRUE(x.try_push_back(2));
+  ASSERT_FALSE(x.try_push_back(3));
+  // A blocked producer gets in once a consumer makes room
+  std::thread producer([&x] () {
+      x.push_back(3);});
+  int v;
+  ASSERT_TRUE(x.pop_front(v));
+  ASSERT_EQ(v, 1);
+  producer.join();
+  ASSERT_EQ(x.size(), 2u);
+  ASSERT_TRUE(x.pop_back(v));
+  ASSERT_EQ(v, 3);
+}
+
+TEST(TestMyConcurrentDeque, Close_1) {
+  my_concurrent_deque<int> x;
+  int v = 0;
+  std::thread consumer([&x, &v] () {
+      int w;
+      while (x.pop_front(w))
+        v += w;});
+  x.push_back(1);
+  x.push_back(2);
+  x.close();
+  consumer.join();
+  ASSERT_EQ(v, 3);
+  ASSERT_TRUE(x.closed());
+  ASSERT_FALSE(x.push_back(4));
+  ASSERT_FALSE(x.pop_front(v));
+}
+
+TEST(TestMyConcurrentDeque, Threads_1) {
+  // Several producers, some batched, and several consumers, some batched,
+  // through a small bound; every element arrives exactly once
+  const int n         = 20000;
+  const int producers = 4;
+  const int consumers = 4;
+  my_concurrent_deque<int> x(64);
+  std::vector<int> counts(producers * n, 0);
+  std::mutex m;
+  std::vector<std::thread> ts;
+  for (int p = 0; p < producers; ++p)
+    ts.push_back(std::thread([&x, p, n] () {
+        if (p % 2)
+          for (int i = 0; i < n; ++i)
+            x.push_back(p * n + i);
+        else {
+          std::vector<int> a;
+          for (int i = 0; i < n; ++i)
+            a.push_back(p * n + i);
+          for (int i = 0; i < n; i += 100)
+            x.push_back_batch(a.begin() + i, a.begin() + i + 100);
+        }}));
+  std::vector<std::thread> cs;
+  for (int c = 0; c < consumers; ++c)
+    cs.push_back(std::thread([&x, &counts, &m, c] () {
+        std::vector<int> got;
+        int v;
+        if (c % 2)
+          while (x.pop_front(v))
+            got.push_back(v);
+        else
+          while (x.pop_front_batch(50, std::back_inserter(got))) {}
+        std::lock_guard<std::mutex> g(m);
+        for (int w : got)
+          ++counts[w];}));
+  for (std::thread& t : ts)
+    t.join();
+  x.close();
+  for (std::thread& t : cs)
+    t.join();
+  ASSERT_EQ(std::count(counts.begin(), counts.end(), 1), producers * n);
+}